@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "forma/template.hh"
+#include "forma/thread_pool.hh"
+
+namespace forma
+{
+// Render the template for every item on the pool.
+// The callback gets the index of the item and the output, rendered into a buffer that is reused
+// by the thread. It's called from the worker threads and the output is only valid during the call.
+template<typename T, typename TCallback>
+void RenderBatch(
+	const Template<T>& compiled, std::span<const T> items, ThreadPool* pool, TCallback&& callback
+)
+{
+	std::vector<std::string> buffers(pool->Slots());
+	pool->ForEach(
+		items.size(),
+		[&](std::size_t index, std::size_t slot)
+		{
+			auto& buffer = buffers[slot];
+			buffer.clear();
+			compiled.Render(items[index], &buffer);
+			callback(index, std::string_view{buffer});
+		}
+	);
+}
+
+// the output of every item, in the same order as the items
+template<typename T>
+std::vector<std::string> RenderBatch(
+	const Template<T>& compiled, std::span<const T> items, ThreadPool* pool
+)
+{
+	std::vector<std::string> outputs(items.size());
+	pool->ForEach(
+		items.size(),
+		[&](std::size_t index, std::size_t) { compiled.Render(items[index], &outputs[index]); }
+	);
+	return outputs;
+}
+
+// the output of all items concatenated, in the same order as the items
+template<typename T>
+std::string RenderBatchJoined(
+	const Template<T>& compiled, std::span<const T> items, ThreadPool* pool
+)
+{
+	// a few chunks per thread so the threads can steal, and each chunk is rendered in order
+	const auto chunk_count = std::min(items.size(), pool->Slots() * 4);
+	std::vector<std::string> chunks(chunk_count);
+	pool->ForEach(
+		chunk_count,
+		[&](std::size_t chunk, std::size_t)
+		{
+			const auto begin = items.size() * chunk / chunk_count;
+			const auto end = items.size() * (chunk + 1) / chunk_count;
+			for (auto index = begin; index < end; index += 1)
+			{
+				compiled.Render(items[index], &chunks[chunk]);
+			}
+		}
+	);
+
+	std::size_t size = 0;
+	for (const auto& chunk: chunks)
+	{
+		size += chunk.size();
+	}
+
+	std::string joined;
+	joined.reserve(size);
+	for (const auto& chunk: chunks)
+	{
+		joined += chunk;
+	}
+	return joined;
+}
+}  //  namespace forma
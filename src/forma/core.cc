@@ -1,9 +1,140 @@
 #include "forma/core.hh"
 
 #include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+	#include <immintrin.h>
+	#define FORMA_STRINGS_SIMD 1
+#endif
 
 namespace forma
 {
+SourceText VfsRead::ReadSource(const std::string& path)
+{
+	auto text = std::make_shared<const std::string>(ReadAllText(path));
+	return {*text, std::move(text)};
+}
+
+void Sink::Reserve(std::size_t)
+{
+}
+
+StringSink::StringSink(std::string* t)
+	: target(t)
+{
+}
+
+void StringSink::Write(std::string_view text)
+{
+	target->append(text);
+}
+
+void StringSink::Reserve(std::size_t size)
+{
+	// grow at least geometrically so repeated appends to the same string stay linear
+	const auto needed = target->size() + size;
+	if (needed > target->capacity())
+	{
+		target->reserve(std::max(needed, target->capacity() * 2));
+	}
+}
+
+PmrStringSink::PmrStringSink(std::pmr::string* t)
+	: target(t)
+{
+}
+
+void PmrStringSink::Write(std::string_view text)
+{
+	target->append(text);
+}
+
+void PmrStringSink::Reserve(std::size_t size)
+{
+	const auto needed = target->size() + size;
+	if (needed > target->capacity())
+	{
+		target->reserve(std::max(needed, target->capacity() * 2));
+	}
+}
+
+StreamSink::StreamSink(std::ostream* s)
+	: stream(s)
+{
+}
+
+void StreamSink::Write(std::string_view text)
+{
+	stream->write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+MeasuringSink::MeasuringSink(Sink* t)
+	: target(t)
+{
+}
+
+void MeasuringSink::Write(std::string_view text)
+{
+	written += text.size();
+	target->Write(text);
+}
+
+void MeasuringSink::Reserve(std::size_t size)
+{
+	target->Reserve(size);
+}
+
+std::string_view ToText(const Value& value, NumberBuffer* buffer)
+{
+	const auto format = [buffer](auto number)
+	{
+		auto* first = buffer->data();
+		const auto [end, ec] = std::to_chars(first, first + buffer->size(), number);
+		return std::string_view{first, static_cast<std::size_t>(end - first)};
+	};
+
+	switch (value.index())
+	{
+	case 0: return std::get<std::string_view>(value);
+	case 1: return std::get<std::string>(value);
+	case 2: return format(std::get<std::int64_t>(value));
+	case 3: return format(std::get<double>(value));
+	default: return std::get<bool>(value) ? "true" : "false";
+	}
+}
+
+void WriteValue(const Value& value, Sink& sink)
+{
+	NumberBuffer buffer;
+	sink.Write(ToText(value, &buffer));
+}
+
+Func StringFunc(std::function<std::string(std::string)> f)
+{
+	return [f](const Value& argument, Sink& output)
+	{
+		NumberBuffer buffer;
+		output.Write(f(std::string{ToText(argument, &buffer)}));
+	};
+}
+
+FuncGenerator FromStringGenerator(StringFuncGenerator generator)
+{
+	return [generator](Location call, std::vector<FuncArgument> arguments) -> FuncGeneratorResult
+	{
+		auto [f, errors] = generator(call, std::move(arguments));
+		if (errors.empty() == false)
+		{
+			const auto failed = [](const Value&, Sink& output) { output.Write("syntax error"); };
+			return {failed, std::move(errors)};
+		}
+		return {StringFunc(std::move(f)), NoErrors()};
+	};
+}
+
 std::vector<Error> NoErrors()
 {
 	return {};
@@ -14,7 +145,7 @@ Location UnknownLocation()
 	return {{"unknown-file.txt"}, -1, -1};
 }
 
-std::string MatchStrings(std::string& name, const std::vector<std::string>& candidates)
+std::string MatchStrings(const std::string& name, const std::vector<std::string>& candidates)
 {
 #if 0
         auto all = candidates.ToImmutableArray();
@@ -190,57 +321,441 @@ namespace strings
 
 	std::string default_space()
 	{
-		return " \t\n\r";
+		return std::string{default_space_view};
 	}
 
-	std::string TrimStart(const std::string& s, const std::string& spaces)
+	// run a kernel over the text, a chunk on the stack at a time, and write each chunk
+	template<typename F>
+	void WriteChunked(std::string_view s, Sink& sink, F&& kernel)
 	{
-		size_t start = s.find_first_not_of(spaces);
-		return (start == std::string::npos) ? "" : s.substr(start);
+		std::array<char, 1024> chunk;
+		for (std::size_t start = 0; start < s.size(); start += chunk.size())
+		{
+			const auto size = std::min(chunk.size(), s.size() - start);
+			kernel(s.data() + start, chunk.data(), size);
+			sink.Write({chunk.data(), size});
+		}
 	}
 
-	std::string TrimEnd(const std::string& s, const std::string& spaces)
+	// flips the ascii case of the characters in [first, last] for all whole blocks
+	// returns the number of characters handled, the caller handles the rest
+	std::size_t FlipCaseBlocks(const char* in, char* out, std::size_t size, char first, char last)
 	{
-		size_t end = s.find_last_not_of(spaces);
-		return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+		std::size_t index = 0;
+
+#if defined(__AVX2__)
+		const auto below32 = _mm256_set1_epi8(static_cast<char>(first - 1));
+		const auto above32 = _mm256_set1_epi8(static_cast<char>(last + 1));
+		const auto flip32 = _mm256_set1_epi8(0x20);
+		for (; index + 32 <= size; index += 32)
+		{
+			const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + index));
+			const auto inside = _mm256_and_si256(
+				_mm256_cmpgt_epi8(chunk, below32), _mm256_cmpgt_epi8(above32, chunk)
+			);
+			const auto flipped = _mm256_xor_si256(chunk, _mm256_and_si256(inside, flip32));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + index), flipped);
+		}
+#endif
+
+#if defined(FORMA_STRINGS_SIMD)
+		// bytes are compared as signed so everything above 127 is outside the range
+		const auto below16 = _mm_set1_epi8(static_cast<char>(first - 1));
+		const auto above16 = _mm_set1_epi8(static_cast<char>(last + 1));
+		const auto flip16 = _mm_set1_epi8(0x20);
+		for (; index + 16 <= size; index += 16)
+		{
+			const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + index));
+			const auto inside
+				= _mm_and_si128(_mm_cmpgt_epi8(chunk, below16), _mm_cmpgt_epi8(above16, chunk));
+			const auto flipped = _mm_xor_si128(chunk, _mm_and_si128(inside, flip16));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + index), flipped);
+		}
+#endif
+
+		return index;
 	}
 
-	std::string Capitalize(const std::string& p, bool alsoFirstChar)
+	void LowerAscii(const char* in, char* out, std::size_t size)
+	{
+		for (auto index = FlipCaseBlocks(in, out, size, 'A', 'Z'); index < size; index += 1)
+		{
+			out[index] = to_lower(in[index]);
+		}
+	}
+
+	void UpperAscii(const char* in, char* out, std::size_t size)
+	{
+		for (auto index = FlipCaseBlocks(in, out, size, 'a', 'z'); index < size; index += 1)
+		{
+			out[index] = to_upper(in[index]);
+		}
+	}
+
+	// Only the first letter after a space is capitalized, so instead of visiting every
+	// letter jump to the next letter while capitalizing and to the next space otherwise.
+	// Bit i of the masks is the lower cased character at out[index + i].
+	bool CapitalizeMasked(
+		char* out,
+		std::size_t index,
+		std::uint32_t letters,
+		std::uint32_t spaces,
+		std::uint32_t valid,
+		bool cap
+	)
+	{
+		auto remaining = valid;
+		while (true)
+		{
+			const auto next = (cap ? letters : spaces) & remaining;
+			if (next == 0) return cap;
+			const auto bit = std::countr_zero(next);
+			if (cap)
+			{
+				out[index + static_cast<std::size_t>(bit)] ^= 0x20;
+			}
+			cap = ! cap;
+			remaining &= ~((std::uint32_t{2} << bit) - 1);
+		}
+	}
+
+	// capitalize the lower cased out[index, size) a block of 32 characters at a time, so the
+	// masks always have a bit for each character
+	bool CapitalizeLowered(char* out, std::size_t index, std::size_t size, bool cap)
+	{
+		for (; index < size; index += 32)
+		{
+			const auto block = std::min<std::size_t>(size - index, 32);
+			std::uint32_t letters = 0;
+			std::uint32_t spaces = 0;
+			for (std::size_t bit = 0; bit < block; bit += 1)
+			{
+				const auto c = out[index + bit];
+				if (is_letter(c)) letters |= std::uint32_t{1} << bit;
+				if (is_whitespace(c)) spaces |= std::uint32_t{1} << bit;
+			}
+			const auto valid
+				= block == 32 ? ~std::uint32_t{0} : (std::uint32_t{1} << block) - 1;
+			cap = CapitalizeMasked(out, index, letters, spaces, valid, cap);
+		}
+		return cap;
+	}
+
+	bool CapitalizeAsciiScalar(const char* in, char* out, std::size_t size, bool cap)
+	{
+		for (std::size_t index = 0; index < size; index += 1)
+		{
+			out[index] = to_lower(in[index]);
+		}
+		return CapitalizeLowered(out, 0, size, cap);
+	}
+
+	bool CapitalizeAscii(const char* in, char* out, std::size_t size, bool cap)
+	{
+		LowerAscii(in, out, size);
+
+		std::size_t index = 0;
+
+#if defined(FORMA_STRINGS_SIMD)
+		const auto below_a = _mm_set1_epi8('a' - 1);
+		const auto above_z = _mm_set1_epi8('z' + 1);
+		const auto space = _mm_set1_epi8(' ');
+		const auto tab = _mm_set1_epi8('\t');
+		const auto cr = _mm_set1_epi8('\r');
+		const auto nl = _mm_set1_epi8('\n');
+		for (; index + 16 <= size; index += 16)
+		{
+			const auto lowered = _mm_loadu_si128(reinterpret_cast<const __m128i*>(out + index));
+			const auto letters = static_cast<std::uint32_t>(_mm_movemask_epi8(
+				_mm_and_si128(_mm_cmpgt_epi8(lowered, below_a), _mm_cmpgt_epi8(above_z, lowered))
+			));
+			const auto spaces = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(lowered, space), _mm_cmpeq_epi8(lowered, tab)),
+				_mm_or_si128(_mm_cmpeq_epi8(lowered, cr), _mm_cmpeq_epi8(lowered, nl))
+			)));
+			cap = CapitalizeMasked(out, index, letters, spaces, 0xFFFF, cap);
+		}
+#endif
+
+		return CapitalizeLowered(out, index, size, cap);
+	}
+
+	template<typename F>
+	std::string ToString(F&& write)
+	{
+		std::string r;
+		StringSink sink{&r};
+		write(sink);
+		return r;
+	}
+
+	std::string_view TrimStartView(std::string_view s, std::string_view spaces)
+	{
+		const auto start = s.find_first_not_of(spaces);
+		return start == std::string_view::npos ? std::string_view{} : s.substr(start);
+	}
+
+	std::string_view TrimEndView(std::string_view s, std::string_view spaces)
+	{
+		const auto end = s.find_last_not_of(spaces);
+		return end == std::string_view::npos ? std::string_view{} : s.substr(0, end + 1);
+	}
+
+	std::string_view TrimView(std::string_view s, std::string_view spaces)
+	{
+		return TrimStartView(TrimEndView(s, spaces), spaces);
+	}
+
+	std::string_view SubstringView(std::string_view arg, int start, int count)
+	{
+		// todo(Gustav): how do we want to handle negative indices... index from the end?
+		return arg.substr(start, count);
+	}
+
+	void WriteCapitalized(std::string_view p, bool alsoFirstChar, Sink& sink)
 	{
 		auto cap = alsoFirstChar;
-		std::ostringstream sb;
-		for (char h: p)
+		WriteChunked(
+			p,
+			sink,
+			[&cap](const char* in, char* out, std::size_t size)
+			{ cap = CapitalizeAscii(in, out, size, cap); }
+		);
+	}
+
+	void WriteLower(std::string_view args, Sink& sink)
+	{
+		WriteChunked(args, sink, LowerAscii);
+	}
+
+	void WriteUpper(std::string_view args, Sink& sink)
+	{
+		WriteChunked(args, sink, UpperAscii);
+	}
+
+	std::size_t FindText(std::string_view haystack, std::string_view needle, std::size_t start)
+	{
+		const auto size = needle.size();
+		if (size < 2)
 		{
-			auto c = to_lower(h);
-			if (is_letter(c) && cap)
+			// a single character is a memchr which is already vectorized
+			return haystack.find(needle, start);
+		}
+
+		auto index = start;
+
+#if defined(FORMA_STRINGS_SIMD)
+		// compare the first and the last character of the needle at 16 positions at once
+		// and only compare the whole needle where both match
+		const auto* data = haystack.data();
+		const auto first = _mm_set1_epi8(needle.front());
+		const auto last = _mm_set1_epi8(needle.back());
+		for (; index + size - 1 + 16 <= haystack.size(); index += 16)
+		{
+			const auto firsts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+			const auto lasts
+				= _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index + size - 1));
+			auto candidates = static_cast<std::uint32_t>(_mm_movemask_epi8(
+				_mm_and_si128(_mm_cmpeq_epi8(firsts, first), _mm_cmpeq_epi8(lasts, last))
+			));
+			while (candidates != 0)
 			{
-				c = to_upper(c);
-				cap = false;
+				const auto found = index + static_cast<std::size_t>(std::countr_zero(candidates));
+				if (haystack.compare(found + 1, size - 2, needle.substr(1, size - 2)) == 0)
+				{
+					return found;
+				}
+				candidates &= candidates - 1;
 			}
-			if (is_whitespace(c)) cap = true;
-			sb << c;
 		}
-		return sb.str();
+#endif
+
+		return haystack.find(needle, index);
 	}
 
-	std::string ToLower(const std::string& args)
+	void WriteReplaced(std::string_view arg, std::string_view lhs, std::string_view rhs, Sink& sink)
 	{
-		std::ostringstream ss;
-		for (char c: args)
+		if (lhs.empty())
 		{
-			ss << to_lower(c);
+			sink.Write(arg);
+			return;
 		}
-		return ss.str();
+
+		const auto first = FindText(arg, lhs, 0);
+		if (first == std::string_view::npos)
+		{
+			sink.Write(arg);
+			return;
+		}
+
+		// count the matches first so the output can be reserved once, without storing them
+		std::size_t count = 0;
+		for (auto found = first; found != std::string_view::npos;
+			 found = FindText(arg, lhs, found + lhs.size()))
+		{
+			count += 1;
+		}
+
+		sink.Reserve(arg.size() - count * lhs.size() + count * rhs.size());
+		std::size_t start = 0;
+		for (auto found = first; found != std::string_view::npos;
+			 found = FindText(arg, lhs, found + lhs.size()))
+		{
+			sink.Write(arg.substr(start, found - start));
+			sink.Write(rhs);
+			start = found + lhs.size();
+		}
+		sink.Write(arg.substr(start));
 	}
 
-	std::string ToUpper(const std::string& args)
+	MultiReplace::MultiReplace(std::vector<std::pair<std::string, std::string>> replacements)
+		: replacements(std::move(replacements))
+		, nodes(1)
 	{
-		std::ostringstream ss;
-		for (char c: args)
+		// the trie of all patterns
+		for (std::size_t pattern = 0; pattern < this->replacements.size(); pattern += 1)
 		{
-			ss << to_upper(c);
+			std::size_t node = 0;
+			for (const auto c: this->replacements[pattern].first)
+			{
+				const auto index = static_cast<unsigned char>(c);
+				if (nodes[node].Next[index] == 0)
+				{
+					nodes[node].Next[index] = static_cast<std::uint32_t>(nodes.size());
+					nodes.emplace_back();
+					nodes.back().Depth = nodes[node].Depth + 1;
+				}
+				node = nodes[node].Next[index];
+			}
+			// empty patterns are ignored and the first of duplicated patterns wins
+			if (node != 0 && nodes[node].Pattern == NoPattern)
+			{
+				nodes[node].Pattern = static_cast<std::uint32_t>(pattern);
+			}
+		}
+
+		// breadth first, fill in the failure transitions so every step is a single lookup
+		std::vector<std::uint32_t> queue;
+		for (auto& next: nodes[0].Next)
+		{
+			if (next != 0)
+			{
+				queue.emplace_back(next);
+			}
+		}
+		for (std::size_t at = 0; at < queue.size(); at += 1)
+		{
+			const auto node = queue[at];
+			const auto fail = nodes[node].Fail;
+			nodes[node].Output
+				= nodes[fail].Pattern != NoPattern ? fail : nodes[fail].Output;
+			for (std::size_t c = 0; c < 256; c += 1)
+			{
+				auto& next = nodes[node].Next[c];
+				if (next != 0)
+				{
+					nodes[next].Fail = nodes[fail].Next[c];
+					queue.emplace_back(next);
+				}
+				else
+				{
+					next = nodes[fail].Next[c];
+				}
+			}
+		}
+	}
+
+	void MultiReplace::Write(std::string_view text, Sink& sink) const
+	{
+		// At each position the longest pattern that starts there is replaced. The leftmost
+		// match, and the longest for that start, is only final once no later match can start
+		// at or before it. Then it is replaced and the search starts over after it, so the
+		// matches overlapping it are never seen and nothing needs to be buffered.
+		constexpr auto none = std::string_view::npos;
+		auto best_start = none;
+		std::size_t best_size = 0;
+		std::uint32_t best_pattern = NoPattern;
+		std::size_t written = 0;
+
+		std::uint32_t node = 0;
+		std::size_t index = 0;
+
+		const auto replace_best = [&]()
+		{
+			sink.Write(text.substr(written, best_start - written));
+			sink.Write(replacements[best_pattern].second);
+			written = best_start + best_size;
+			best_start = none;
+			node = 0;
+			index = written;
+		};
+
+		while (index < text.size() || best_start != none)
+		{
+			if (index == text.size())
+			{
+				replace_best();
+				continue;
+			}
+
+			node = nodes[node].Next[static_cast<unsigned char>(text[index])];
+			const auto end = index + 1;
+
+			// later matches all start in the text of the current node or after it
+			if (best_start != none && best_start < end - nodes[node].Depth)
+			{
+				replace_best();
+				continue;
+			}
+
+			for (auto out = nodes[node].Pattern != NoPattern ? node : nodes[node].Output; out != 0;
+				 out = nodes[out].Output)
+			{
+				const auto size = nodes[out].Depth;
+				const auto start = end - size;
+				if (best_start == none || start < best_start
+					|| (start == best_start && size > best_size))
+				{
+					best_start = start;
+					best_size = size;
+					best_pattern = nodes[out].Pattern;
+				}
+			}
+			index = end;
 		}
-		return ss.str();
+
+		sink.Write(text.substr(written));
+	}
+
+	std::string TrimStart(const std::string& s, const std::string& spaces)
+	{
+		return std::string{TrimStartView(s, spaces)};
+	}
+
+	std::string TrimEnd(const std::string& s, const std::string& spaces)
+	{
+		return std::string{TrimEndView(s, spaces)};
+	}
+
+	std::string Capitalize(const std::string& p, bool alsoFirstChar)
+	{
+		std::string r(p.size(), '\0');
+		CapitalizeAscii(p.data(), r.data(), p.size(), alsoFirstChar);
+		return r;
+	}
+
+	std::string ToLower(const std::string& args)
+	{
+		std::string r(args.size(), '\0');
+		LowerAscii(args.data(), r.data(), args.size());
+		return r;
+	}
+
+	std::string ToUpper(const std::string& args)
+	{
+		std::string r(args.size(), '\0');
+		UpperAscii(args.data(), r.data(), args.size());
+		return r;
 	}
 
 	std::string ToTitleCase(const std::string& args)
@@ -250,7 +765,7 @@ namespace strings
 
 	std::string Trim(const std::string& s, const std::string& space)
 	{
-		return TrimStart(TrimEnd(s, space), space);
+		return std::string{TrimView(s, space)};
 	}
 
 	std::string PadLeft(const std::string& s, int count, char c)
@@ -263,21 +778,12 @@ namespace strings
 
 	std::string Replace(const std::string& arg, const std::string& lhs, const std::string& rhs)
 	{
-		std::string r = arg;
-		auto start = 0;
-		while (true)
-		{
-			auto found = r.find(lhs, start);
-			if (found == std::string::npos) return r;
-			r.replace(found, lhs.length(), rhs);
-			start = found + rhs.length();
-		}
+		return ToString([&](Sink& sink) { WriteReplaced(arg, lhs, rhs, sink); });
 	}
 
 	std::string Substring(const std::string& arg, int start, int count)
 	{
-		// todo(Gustav): how do we want to handle negative indices... index from the end?
-		return arg.substr(start, count);
+		return std::string{SubstringView(arg, start, count)};
 	}
 }  //  namespace strings
 }  //  namespace forma
@@ -1,19 +1,40 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <functional>
+#include <memory>
+#include <memory_resource>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 #include <sstream>
+#include <ostream>
 
 namespace forma
 {
 // ------------------------------------------------------------------------
 // file integration
+// the text of a file and whatever keeps the text alive
+struct SourceText
+{
+	std::string_view Text;
+	std::shared_ptr<const void> Owner;
+	std::string Error = {};  // why the file couldn't be read, empty if it was
+};
+
 struct VfsRead
 {
 	virtual ~VfsRead() = default;
 	virtual std::string ReadAllText(const std::string& path) = 0;
 	virtual bool Exists(const std::string& f) = 0;
 	virtual std::string GetExtension(const std::string& file_path) = 0;
+
+	// read the file without copying it if possible, by default this keeps the ReadAllText result
+	virtual SourceText ReadSource(const std::string& path);
 };
 
 struct DirectoryInfo
@@ -22,6 +43,113 @@ struct DirectoryInfo
 	virtual std::string GetFile(const std::string& nameAndExtension) = 0;
 };
 
+// ------------------------------------------------------------------------
+// output integration
+
+// receives the rendered output, piece by piece
+struct Sink
+{
+	virtual ~Sink() = default;
+	virtual void Write(std::string_view text) = 0;
+
+	// a hint that about size more bytes are about to be written, does nothing by default
+	virtual void Reserve(std::size_t size);
+};
+
+// appends to a caller owned string, reuse the string to reuse the buffer
+struct StringSink : Sink
+{
+	explicit StringSink(std::string* t);
+	void Write(std::string_view text) override;
+	void Reserve(std::size_t size) override;
+
+	std::string* target;
+};
+
+// appends to a string that allocates from a memory resource
+struct PmrStringSink : Sink
+{
+	explicit PmrStringSink(std::pmr::string* t);
+	void Write(std::string_view text) override;
+	void Reserve(std::size_t size) override;
+
+	std::pmr::string* target;
+};
+
+struct StreamSink : Sink
+{
+	explicit StreamSink(std::ostream* s);
+	void Write(std::string_view text) override;
+
+	std::ostream* stream;
+};
+
+// forwards to another sink and counts the bytes written
+struct MeasuringSink : Sink
+{
+	explicit MeasuringSink(Sink* t);
+	void Write(std::string_view text) override;
+	void Reserve(std::size_t size) override;
+
+	Sink* target;
+	std::size_t written = 0;
+};
+
+// ------------------------------------------------------------------------
+// values
+
+// A typed value, passed from the getters through the functions to the output.
+// A string_view refers to data owned by the object that is being rendered.
+using Value = std::variant<std::string_view, std::string, std::int64_t, double, bool>;
+
+// room for any formatted number
+using NumberBuffer = std::array<char, 64>;
+
+// the text of the value, numbers are formatted into the buffer
+std::string_view ToText(const Value& value, NumberBuffer* buffer);
+
+void WriteValue(const Value& value, Sink& sink);
+
+// Wrap the result of a getter.
+// References to strings become views, temporaries die with the getter call so they are owned:
+// a std::string is moved and anything else that converts to a string_view is copied.
+template<typename TResult>
+Value MakeValue(TResult&& result)
+{
+	using Type = std::remove_cvref_t<TResult>;
+	if constexpr (std::is_same_v<Type, bool>)
+	{
+		return result;
+	}
+	else if constexpr (std::is_integral_v<Type>)
+	{
+		return static_cast<std::int64_t>(result);
+	}
+	else if constexpr (std::is_floating_point_v<Type>)
+	{
+		return static_cast<double>(result);
+	}
+	else
+	{
+		static_assert(
+			std::is_convertible_v<const Type&, std::string_view>,
+			"values must be strings, numbers or bools"
+		);
+		if constexpr (std::is_lvalue_reference_v<TResult>)
+		{
+			return std::string_view{result};
+		}
+		else if constexpr (std::is_same_v<Type, std::string>)
+		{
+			return std::string{std::move(result)};
+		}
+		else
+		{
+			return std::string{std::string_view{result}};
+		}
+	}
+}
+
 // ------------------------------------------------------------------------
 // forma util
 
@@ -80,14 +208,24 @@ struct FuncArgument
 	std::string Argument;
 };
 
-// apply dynamic std::string function and return result
-using Func = std::function<std::string(std::string)>;
+// apply a function to the argument and write the result
+using Func = std::function<void(const Value& argument, Sink& output)>;
+
+// adapt a function that works on the text of the argument
+Func StringFunc(std::function<std::string(std::string)> f);
 
 // parse arguments, return function call or error
 using FuncGeneratorResult = std::pair<Func, std::vector<Error>>;
 using FuncGenerator
 	= std::function<FuncGeneratorResult(Location call, std::vector<FuncArgument> arguments)>;
 
+// the older generators of functions that work on the text of the argument
+using StringFuncGeneratorResult
+	= std::pair<std::function<std::string(std::string)>, std::vector<Error>>;
+using StringFuncGenerator
+	= std::function<StringFuncGeneratorResult(Location call, std::vector<FuncArgument> arguments)>;
+FuncGenerator FromStringGenerator(StringFuncGenerator generator);
+
 std::vector<Error> NoErrors();
 Location UnknownLocation();
 
@@ -102,11 +240,69 @@ std::vector<K> KeysOf(const std::unordered_map<K, V>& m)
 	return ks;
 }
 
-std::string MatchStrings(std::string& name, const std::vector<std::string>& candidates);
+std::string MatchStrings(const std::string& name, const std::vector<std::string>& candidates);
 
 namespace strings
 {
+	constexpr std::string_view default_space_view = " \t\n\r";
 	std::string default_space();
+
+	// views into the argument, nothing is copied
+	std::string_view TrimStartView(std::string_view s, std::string_view = default_space_view);
+	std::string_view TrimEndView(std::string_view s, std::string_view = default_space_view);
+	std::string_view TrimView(std::string_view s, std::string_view = default_space_view);
+	std::string_view SubstringView(std::string_view arg, int lhs, int rhs);
+
+	// ascii case conversion of whole buffers, out must have room for size characters
+	void LowerAscii(const char* in, char* out, std::size_t size);
+	void UpperAscii(const char* in, char* out, std::size_t size);
+
+	// lower case all and upper case the first letter after each space, and the very first letter
+	// if cap is true, returns true if the first letter of the next buffer should be upper cased
+	bool CapitalizeAscii(const char* in, char* out, std::size_t size, bool cap);
+
+	// the same without simd, like CapitalizeAscii on targets without sse2
+	bool CapitalizeAsciiScalar(const char* in, char* out, std::size_t size, bool cap);
+
+	// write the result directly to the sink
+	void WriteCapitalized(std::string_view p, bool alsoFirstChar, Sink& sink);
+	void WriteLower(std::string_view args, Sink& sink);
+	void WriteUpper(std::string_view args, Sink& sink);
+	void WriteReplaced(
+		std::string_view arg, std::string_view lhs, std::string_view rhs, Sink& sink
+	);
+
+	// the first position of needle at or after start, or npos
+	std::size_t FindText(std::string_view haystack, std::string_view needle, std::size_t start);
+
+	// Replace several patterns in a single pass over the text with a Aho-Corasick automaton.
+	// At each position the longest pattern that starts there is replaced, replaced text is
+	// never searched again. Patterns must not be empty.
+	class MultiReplace
+	{
+	   public:
+
+		explicit MultiReplace(std::vector<std::pair<std::string, std::string>> replacements);
+
+		void Write(std::string_view text, Sink& sink) const;
+
+	   private:
+
+		static constexpr std::uint32_t NoPattern = ~std::uint32_t{0};
+
+		struct Node
+		{
+			std::array<std::uint32_t, 256> Next = {};  // the full transition table
+			std::uint32_t Fail = 0;
+			std::uint32_t Output = 0;  // the next node with a pattern along the failure links
+			std::uint32_t Pattern = NoPattern;  // the pattern ending here
+			std::size_t Depth = 0;
+		};
+
+		std::vector<std::pair<std::string, std::string>> replacements;
+		std::vector<Node> nodes;
+	};
+
 	std::string TrimStart(const std::string& s, const std::string& = default_space());
 	std::string TrimEnd(const std::string& s, const std::string& = default_space());
 	std::string Trim(const std::string& s, const std::string& = default_space());
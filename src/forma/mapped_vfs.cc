@@ -0,0 +1,169 @@
+#include "forma/mapped_vfs.hh"
+
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <system_error>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace forma
+{
+// a read only mapping of a whole file, if the file couldn't be mapped the error says why
+class FileMapping
+{
+   public:
+
+	explicit FileMapping(const std::string& path)
+	{
+#if defined(_WIN32)
+		const auto file = CreateFileA(
+			path.c_str(),
+			GENERIC_READ,
+			FILE_SHARE_READ,
+			nullptr,
+			OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			nullptr
+		);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			error = LastError();
+			return;
+		}
+
+		LARGE_INTEGER file_size;
+		if (GetFileSizeEx(file, &file_size) == false)
+		{
+			error = LastError();
+		}
+		else if (file_size.QuadPart > 0)
+		{
+			const auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			data = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+			if (data != nullptr)
+			{
+				size = static_cast<std::size_t>(file_size.QuadPart);
+			}
+			else
+			{
+				error = LastError();
+			}
+			if (mapping != nullptr)
+			{
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		const auto file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			error = LastError();
+			return;
+		}
+
+		struct stat info;
+		if (fstat(file, &info) != 0)
+		{
+			error = LastError();
+		}
+		else if (info.st_size > 0)
+		{
+			const auto file_size = static_cast<std::size_t>(info.st_size);
+			auto* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapped != MAP_FAILED)
+			{
+				data = mapped;
+				size = file_size;
+			}
+			else
+			{
+				error = LastError();
+			}
+		}
+		close(file);
+#endif
+	}
+
+	~FileMapping()
+	{
+		if (data == nullptr) return;
+#if defined(_WIN32)
+		UnmapViewOfFile(data);
+#else
+		munmap(data, size);
+#endif
+	}
+
+	FileMapping(const FileMapping&) = delete;
+	FileMapping& operator=(const FileMapping&) = delete;
+
+	std::string_view Text() const
+	{
+		return {static_cast<const char*>(data), size};
+	}
+
+	// empty if the file was mapped, a empty file is mapped to a empty text
+	const std::string& Error() const
+	{
+		return error;
+	}
+
+   private:
+
+	static std::string LastError()
+	{
+#if defined(_WIN32)
+		return std::system_category().message(static_cast<int>(GetLastError()));
+#else
+		return std::generic_category().message(errno);
+#endif
+	}
+
+	void* data = nullptr;
+	std::size_t size = 0;
+	std::string error;
+};
+
+std::string MappedVfs::ReadAllText(const std::string& path)
+{
+	// a copy made with plain reads, a file truncated while it is read is just read short
+	std::ifstream file{path, std::ios::binary};
+	return std::string{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+}
+
+bool MappedVfs::Exists(const std::string& path)
+{
+	std::error_code error;
+	return std::filesystem::is_regular_file(path, error);
+}
+
+std::string MappedVfs::GetExtension(const std::string& file_path)
+{
+	return std::filesystem::path{file_path}.extension().string();
+}
+
+SourceText MappedVfs::ReadSource(const std::string& path)
+{
+	auto mapping = std::make_shared<const FileMapping>(path);
+	if (mapping->Error().empty() == false)
+	{
+		return {{}, nullptr, mapping->Error()};
+	}
+
+	const auto text = mapping->Text();
+	return {text, std::move(mapping)};
+}
+}  //  namespace forma
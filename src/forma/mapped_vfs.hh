@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+#include "forma/core.hh"
+
+namespace forma
+{
+// Reads template files from disk by memory mapping them.
+// ReadSource hands the mapped pages directly to the scanner, the mapping is kept alive
+// for as long as the returned SourceText is. A file that is truncated while it is mapped
+// raises SIGBUS on POSIX, so replace files instead of editing them in place while they
+// are read. ReadAllText makes a plain copy and is safe to use for change checks, like
+// ContentHashCheck.
+struct MappedVfs : VfsRead
+{
+	std::string ReadAllText(const std::string& path) override;
+	bool Exists(const std::string& path) override;
+	std::string GetExtension(const std::string& file_path) override;
+	SourceText ReadSource(const std::string& path) override;
+};
+}  //  namespace forma
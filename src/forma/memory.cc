@@ -0,0 +1,133 @@
+#include "forma/memory.hh"
+
+#include "forma/core.hh"
+
+namespace forma
+{
+CountingResource::CountingResource(std::pmr::memory_resource* u)
+	: upstream(u)
+{
+}
+
+MemoryStats CountingResource::Stats() const
+{
+	return {
+		allocations.load(std::memory_order_relaxed),
+		bytes.load(std::memory_order_relaxed),
+		peak.load(std::memory_order_relaxed),
+		in_use.load(std::memory_order_relaxed)
+	};
+}
+
+void CountingResource::Reset()
+{
+	allocations.store(0, std::memory_order_relaxed);
+	bytes.store(0, std::memory_order_relaxed);
+	peak.store(in_use.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void* CountingResource::do_allocate(std::size_t size, std::size_t alignment)
+{
+	auto* p = upstream->allocate(size, alignment);
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	bytes.fetch_add(size, std::memory_order_relaxed);
+
+	const auto now = in_use.fetch_add(size, std::memory_order_relaxed) + size;
+	auto highest = peak.load(std::memory_order_relaxed);
+	while (now > highest)
+	{
+		if (peak.compare_exchange_weak(highest, now, std::memory_order_relaxed)) break;
+	}
+	return p;
+}
+
+void CountingResource::do_deallocate(void* p, std::size_t size, std::size_t alignment)
+{
+	upstream->deallocate(p, size, alignment);
+	in_use.fetch_sub(size, std::memory_order_relaxed);
+}
+
+bool CountingResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+LockedResource::LockedResource(std::pmr::memory_resource* u)
+	: upstream(u)
+{
+}
+
+void* LockedResource::do_allocate(std::size_t size, std::size_t alignment)
+{
+	std::scoped_lock lock{mutex};
+	return upstream->allocate(size, alignment);
+}
+
+void LockedResource::do_deallocate(void* p, std::size_t size, std::size_t alignment)
+{
+	std::scoped_lock lock{mutex};
+	upstream->deallocate(p, size, alignment);
+}
+
+bool LockedResource::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+ScratchPool::ScratchPool(std::pmr::memory_resource* u)
+	: upstream(u)
+{
+}
+
+void* ScratchPool::do_allocate(std::size_t size, std::size_t alignment)
+{
+	if (pool.has_value() == false)
+	{
+		pool.emplace(upstream);
+	}
+	return pool->allocate(size, alignment);
+}
+
+void ScratchPool::do_deallocate(void* p, std::size_t size, std::size_t alignment)
+{
+	pool->deallocate(p, size, alignment);
+}
+
+bool ScratchPool::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+	return this == &other;
+}
+
+PhaseMemory::PhaseMemory(std::pmr::memory_resource* upstream)
+	: Scan(upstream)
+	, Parse(upstream)
+	, Build(upstream)
+	, Render(upstream)
+{
+}
+
+void PhaseMemory::Reset()
+{
+	Scan.Reset();
+	Parse.Reset();
+	Build.Reset();
+	Render.Reset();
+}
+
+std::string PhaseMemory::Report() const
+{
+	auto report = Fmt{};
+	report << "phase\tallocations\tbytes\tpeak\tin use\n";
+	const auto phase = [&report](const char* name, const CountingResource& resource)
+	{
+		const auto stats = resource.Stats();
+		report << name << "\t" << stats.Allocations << "\t" << stats.Bytes << "\t" << stats.Peak
+			   << "\t" << stats.InUse << "\n";
+	};
+	phase("scan", Scan);
+	phase("parse", Parse);
+	phase("build", Build);
+	phase("render", Render);
+	return report;
+}
+}  //  namespace forma
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <string>
+
+namespace forma
+{
+struct MemoryStats
+{
+	std::uint64_t Allocations = 0;
+	std::uint64_t Bytes = 0;  // the total of all allocations
+	std::uint64_t Peak = 0;  // the most bytes allocated at the same time
+	std::uint64_t InUse = 0;  // bytes allocated and not yet released
+};
+
+// Forwards to the upstream resource and counts what passes through.
+// The counters are atomic so the resource can be shared between threads if the upstream can.
+class CountingResource : public std::pmr::memory_resource
+{
+   public:
+
+	explicit CountingResource(
+		std::pmr::memory_resource* upstream = std::pmr::get_default_resource()
+	);
+
+	MemoryStats Stats() const;
+
+	// start counting from zero, the peak starts at what is still in use
+	void Reset();
+
+   private:
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	std::pmr::memory_resource* upstream;
+	std::atomic<std::uint64_t> allocations = 0;
+	std::atomic<std::uint64_t> bytes = 0;
+	std::atomic<std::uint64_t> peak = 0;
+	std::atomic<std::uint64_t> in_use = 0;
+};
+
+// Locks around the upstream resource so it can be shared between threads.
+class LockedResource : public std::pmr::memory_resource
+{
+   public:
+
+	explicit LockedResource(std::pmr::memory_resource* upstream);
+
+   private:
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	std::pmr::memory_resource* upstream;
+	std::mutex mutex;
+};
+
+// Recycles freed memory like a unsynchronized_pool_resource but only creates the pool on the
+// first allocation, so using it where nothing is allocated costs nothing.
+class ScratchPool : public std::pmr::memory_resource
+{
+   public:
+
+	explicit ScratchPool(std::pmr::memory_resource* upstream);
+
+   private:
+
+	void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+	void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+	std::pmr::memory_resource* upstream;
+	std::optional<std::pmr::unsynchronized_pool_resource> pool;
+};
+
+// A counting resource for each phase of building and rendering a template.
+// Pass it to BuildTemplate and the resources to Render, then check the stats, for example to
+// assert an allocation budget in a test. What is built keeps allocating from the phase
+// resources, so they need to outlive the tokens, the ast and the template.
+struct PhaseMemory
+{
+	explicit PhaseMemory(std::pmr::memory_resource* upstream = std::pmr::get_default_resource());
+
+	CountingResource Scan;  // the tokens of the root file
+	CountingResource Parse;  // the ast, and the tokens of the included files
+	CountingResource Build;  // the compiled program
+	CountingResource Render;  // the temporaries of the renders given this resource
+
+	void Reset();
+
+	// one line per phase
+	std::string Report() const;
+};
+}  //  namespace forma
@@ -2,83 +2,120 @@
 
 #include "forma/core.hh"
 
+#include <algorithm>
 #include <optional>
 #include <array>
+#include <memory>
 
 namespace forma
 {
-namespace node
+Ast::Ast(std::pmr::memory_resource* memory)
+	: Nodes(memory)
+	, Members(memory)
 {
-	Text::Text(std::string v, forma::Location l)
-		: Value(v)
-		, Location(l)
-	{
-	}
+}
 
-	Text* Text::AsText()
-	{
-		return this;
-	}
+NodeIndex Ast::Add(Node n)
+{
+	Nodes.emplace_back(std::move(n));
+	return static_cast<NodeIndex>(Nodes.size() - 1);
+}
 
-	Attribute::Attribute(std::string n, forma::Location l)
-		: Name(n)
-		, Location(l)
-	{
-	}
+const Node& Ast::operator[](NodeIndex index) const
+{
+	return Nodes[index];
+}
 
-	Attribute* Attribute::AsAttribute()
-	{
-		return this;
-	}
+std::span<const NodeIndex> Ast::MembersOf(const node::Group& group) const
+{
+	return std::span<const NodeIndex>{Members}.subspan(group.First, group.Count);
+}
 
-	Iterate::Iterate(std::string n, std::shared_ptr<Node> b, forma::Location l)
-		: Name(n)
-		, Body(b)
-		, Location(l)
+std::vector<std::string> Ast::Files() const
+{
+	std::vector<std::string> files;
+	for (const auto& n: Nodes)
 	{
+		const auto file = std::visit([](const auto& x) { return x.Location.File; }, n);
+		if (std::find(files.begin(), files.end(), file) == files.end())
+		{
+			files.emplace_back(file);
+		}
 	}
+	return files;
+}
 
-	Iterate* Iterate::AsIterate()
-	{
-		return this;
-	}
+std::shared_ptr<const CachedInclude> IncludeCache::Find(const std::string& path) const
+{
+	std::scoped_lock lock{mutex};
+	const auto found = parsed.find(path);
+	return found == parsed.end() ? nullptr : found->second;
+}
 
-	If::If(std::string n, std::shared_ptr<Node> b, forma::Location l)
-		: Name(n)
-		, Body(b)
-		, Location(l)
-	{
-	}
+void IncludeCache::Add(const std::string& path, std::shared_ptr<const CachedInclude> include)
+{
+	std::scoped_lock lock{mutex};
+	parsed.insert_or_assign(path, std::move(include));
+}
+
+void IncludeCache::Invalidate(const std::string& path)
+{
+	std::scoped_lock lock{mutex};
+	std::erase_if(
+		parsed,
+		[&path](const auto& entry)
+		{
+			const auto& includes = entry.second->Includes;
+			return entry.first == path
+				|| std::find(includes.begin(), includes.end(), path) != includes.end();
+		}
+	);
+}
+
+void IncludeCache::Clear()
+{
+	std::scoped_lock lock{mutex};
+	parsed.clear();
+}
 
-	If* If::AsIf()
+NodeIndex CopyNodes(const Ast& from, NodeIndex root, Ast* to)
+{
+	const auto& n = from[root];
+	if (const auto* iterate = std::get_if<node::Iterate>(&n))
 	{
-		return this;
+		const auto body = CopyNodes(from, iterate->Body, to);
+		return to->Add(node::Iterate{iterate->Name, body, iterate->Location});
 	}
-
-	FunctionCall::FunctionCall(std::string n, Func f, std::shared_ptr<Node> a, forma::Location l)
-		: Name(n)
-		, Function(f)
-		, Arg(a)
-		, Location(l)
+	else if (const auto* check = std::get_if<node::If>(&n))
 	{
+		const auto body = CopyNodes(from, check->Body, to);
+		return to->Add(node::If{check->Name, body, check->Location});
 	}
-
-	FunctionCall* FunctionCall::AsFunctionCall()
+	else if (const auto* fc = std::get_if<node::FunctionCall>(&n))
 	{
-		return this;
+		const auto arg = CopyNodes(from, fc->Arg, to);
+		return to->Add(node::FunctionCall{fc->Name, fc->Arguments, fc->Function, arg, fc->Location}
+		);
 	}
-
-	Group::Group(std::vector<std::shared_ptr<Node>> n, forma::Location l)
-		: Nodes(n)
-		, Location(l)
+	else if (const auto* gr = std::get_if<node::Group>(&n))
 	{
+		// copy the members first so the members of this group end up next to each other
+		std::pmr::vector<NodeIndex> members{to->Members.get_allocator()};
+		members.reserve(gr->Count);
+		for (const auto member: from.MembersOf(*gr))
+		{
+			members.emplace_back(CopyNodes(from, member, to));
+		}
+		const auto first = static_cast<std::uint32_t>(to->Members.size());
+		to->Members.insert(to->Members.end(), members.begin(), members.end());
+		return to->Add(node::Group{first, gr->Count, gr->Location});
 	}
-
-	Group* Group::AsGroup()
+	else
 	{
-		return this;
+		// text and attributes have no children
+		return to->Add(n);
 	}
-}  //  namespace node
+}
 
 template<typename K, typename V>
 std::vector<K> GetKeys(const std::unordered_map<K, V>& m)
@@ -91,125 +128,145 @@ std::vector<K> GetKeys(const std::unordered_map<K, V>& m)
 	return ks;
 }
 
-std::vector<Token> TrimTextTokens(const std::vector<Token>& tokens)
+// Rewrites the scanned tokens before parsing:
+//  - trim text next to {{- and -}} and turn them into regular {{ and }}
+//  - remove empty {{}}
+//  - turn {{/x {{#x and {{?x into end, range and if keywords
+// Each stage only looks one token back so all of them run in a single pass.
+struct TokenRewriter
 {
-	std::vector<Token> r;
+	std::pmr::vector<Token>* output;
 
-	std::optional<Token> lastToken = std::nullopt;
-	for (const auto& tok: tokens)
+	std::optional<Token> lastTrimmed = std::nullopt;
+	std::optional<Token> lastNonEmpty = std::nullopt;
+	std::optional<Token> lastKeyword = std::nullopt;
+	bool eatIdent = false;
+
+	explicit TokenRewriter(std::pmr::vector<Token>* o)
+		: output(o)
+	{
+	}
+
+	void Add(const Token& tok)
+	{
+		TrimText(tok);
+	}
+
+	void Finish()
+	{
+		if (lastTrimmed.has_value())
+		{
+			RemoveEmpty(*lastTrimmed);
+		}
+
+		if (lastNonEmpty.has_value())
+		{
+			TransformSingleCharsToKeywords(*lastNonEmpty);
+		}
+
+		if (lastKeyword.has_value())
+		{
+			output->emplace_back(*lastKeyword);
+		}
+	}
+
+	void TrimText(const Token& tok)
 	{
 		switch (tok.Type)
 		{
 		case TokenType::BeginCodeTrim:
-			if (lastToken.has_value() && lastToken->Type == TokenType::Text)
+			if (lastTrimmed.has_value() && lastTrimmed->Type == TokenType::Text)
 			{
-				r.emplace_back(lastToken->withValue(strings::TrimEnd(lastToken->Value)));
+				RemoveEmpty(lastTrimmed->withValue(strings::TrimEndView(lastTrimmed->Value)));
 			}
 
-			lastToken = tok.withType(TokenType::BeginCode);
+			lastTrimmed = tok.withType(TokenType::BeginCode);
 			break;
 		case TokenType::Text:
-			if (lastToken.has_value() && lastToken->Type == TokenType::EndCodeTrim)
+			if (lastTrimmed.has_value() && lastTrimmed->Type == TokenType::EndCodeTrim)
 			{
-				r.emplace_back(lastToken->withType(TokenType::EndCode));
-				lastToken = tok.withValue(strings::TrimStart(tok.Value));
+				RemoveEmpty(lastTrimmed->withType(TokenType::EndCode));
+				lastTrimmed = tok.withValue(strings::TrimStartView(tok.Value));
 				break;
 			}
 		default:
-			if (lastToken.has_value())
+			if (lastTrimmed.has_value())
 			{
-				r.emplace_back(*lastToken);
+				RemoveEmpty(*lastTrimmed);
 			}
 
-			lastToken = tok;
+			lastTrimmed = tok;
 			break;
 		}
 	}
 
-	if (lastToken.has_value())
-	{
-		r.emplace_back(*lastToken);
-	}
-
-	return r;
-}
-
-std::vector<Token> TrimEmptyStartEnd(const std::vector<Token>& tokens)
-{
-	std::vector<Token> r;
-	std::optional<Token> lastToken = std::nullopt;
-	for (const auto& tok: tokens)
+	void RemoveEmpty(const Token& tok)
 	{
-		if (lastToken.has_value() && lastToken->Type == TokenType::BeginCode
+		if (lastNonEmpty.has_value() && lastNonEmpty->Type == TokenType::BeginCode
 			&& tok.Type == TokenType::EndCode)
 		{
-			lastToken = std::nullopt;
-			continue;
+			lastNonEmpty = std::nullopt;
+			return;
 		}
 
-		if (lastToken.has_value())
+		if (lastNonEmpty.has_value())
 		{
-			r.emplace_back(*lastToken);
+			TransformSingleCharsToKeywords(*lastNonEmpty);
 		}
 
-		lastToken = tok;
-	}
-
-	if (lastToken.has_value())
-	{
-		r.emplace_back(*lastToken);
+		lastNonEmpty = tok;
 	}
 
-	return r;
-}
-
-std::vector<Token> TransformSingleCharsToKeywords(const std::vector<Token>& tokens)
-{
-	auto eatIdent = false;
-	std::vector<Token> r;
-	std::optional<Token> lastToken = std::nullopt;
-	for (const auto& tok: tokens)
+	void TransformSingleCharsToKeywords(const Token& tok)
 	{
 		if (tok.Type == TokenType::Ident && eatIdent)
 		{
 			eatIdent = false;
-			continue;
+			return;
 		}
 
-		if (tok.Type == TokenType::Slash && lastToken.has_value()
-			&& lastToken->Type == TokenType::BeginCode)
+		const auto afterBegin = lastKeyword.has_value() && lastKeyword->Type == TokenType::BeginCode;
+		if (tok.Type == TokenType::Slash && afterBegin)
 		{
-			r.emplace_back(*lastToken);
-			lastToken = tok.withType(TokenType::KeywordEnd);
+			output->emplace_back(*lastKeyword);
+			lastKeyword = tok.withType(TokenType::KeywordEnd);
 			eatIdent = true;
 		}
-		else if (tok.Type == TokenType::Hash && lastToken.has_value()
-				 && lastToken->Type == TokenType::BeginCode)
+		else if (tok.Type == TokenType::Hash && afterBegin)
 		{
-			r.emplace_back(*lastToken);
-			lastToken = tok.withType(TokenType::KeywordRange);
+			output->emplace_back(*lastKeyword);
+			lastKeyword = tok.withType(TokenType::KeywordRange);
 		}
-		else if (tok.Type == TokenType::QuestionMark && lastToken.has_value()
-				 && lastToken->Type == TokenType::BeginCode)
+		else if (tok.Type == TokenType::QuestionMark && afterBegin)
 		{
-			r.emplace_back(*lastToken);
-			lastToken = tok.withType(TokenType::KeywordIf);
+			output->emplace_back(*lastKeyword);
+			lastKeyword = tok.withType(TokenType::KeywordIf);
 		}
 		else
 		{
-			if (lastToken.has_value())
+			if (lastKeyword.has_value())
 			{
-				r.emplace_back(*lastToken);
+				output->emplace_back(*lastKeyword);
 			}
 
-			lastToken = tok;
+			lastKeyword = tok;
 		}
 	}
+};
 
-	if (lastToken.has_value())
+std::pmr::vector<Token> RewriteTokens(
+	std::span<const Token> tokens, std::pmr::memory_resource* memory
+)
+{
+	std::pmr::vector<Token> r{memory};
+	r.reserve(tokens.size());
+
+	auto rewriter = TokenRewriter{&r};
+	for (const auto& tok: tokens)
 	{
-		r.emplace_back(*lastToken);
+		rewriter.Add(tok);
 	}
+	rewriter.Finish();
 
 	return r;
 }
@@ -223,58 +280,78 @@ struct ParseError : std::runtime_error
 	}
 };
 
-struct Parser
+// a file parsed earlier in this parse
+struct IncludedFile
 {
-	std::vector<Token> tokens;
+	NodeIndex Root;
+	std::vector<std::string> Includes;  // the files it includes, directly or not
+	int Depth;  // how many levels of includes are nested below it
+};
 
-	std::unordered_map<std::string, FuncGenerator> functions;
+// state shared by the parser of the root file and the parsers of the included files
+struct ParseContext
+{
+	const std::unordered_map<std::string, FuncGenerator>* functions;
 	DirectoryInfo* includeDir;
 	std::string defaultExtension;
 	VfsRead* vfs;
+	IncludeCache* cache;
+	int maxIncludeDepth;
+	std::pmr::memory_resource* memory;
+
+	Ast* ast;
+	std::vector<std::string> includeStack = {};  // the files currently being parsed, root first
+	std::pmr::vector<NodeIndex> pending{memory};  // members of the groups currently being parsed
+	std::unordered_map<std::string, IncludedFile> included = {};  // each file included so far
+};
+
+struct Parser
+{
+	std::pmr::vector<Token> tokens;
+	ParseContext* context;
+
+	// shortcuts to the context
+	const std::unordered_map<std::string, FuncGenerator>& functions;
+	Ast* ast;
+	std::pmr::vector<NodeIndex>* pending;
 
 	int current = 0;
 	std::vector<Error> errors;
 
-	Parser(
-		std::vector<Token> itok,
-		std::unordered_map<std::string, FuncGenerator> f,
-		DirectoryInfo* i,
-		std::string d,
-		VfsRead* v
-	)
-		: tokens(TransformSingleCharsToKeywords(TrimEmptyStartEnd(TrimTextTokens(itok))))
-		, functions(f)
-		, includeDir(i)
-		, defaultExtension(d)
-		, vfs(v)
+	// the files included by the file being parsed, directly or not, and how deep they nest
+	std::vector<std::string> includes;
+	int includeDepth = 0;
+
+	Parser(std::span<const Token> itok, ParseContext* c)
+		: tokens(RewriteTokens(itok, c->memory))
+		, context(c)
+		, functions(*c->functions)
+		, ast(c->ast)
+		, pending(&c->pending)
 	{
 	}
 
-	ParseResult parse()
+	// parse all tokens, returns the root group
+	NodeIndex parse()
 	{
 		auto rootNode = ParseGroup();
 		if (! IsAtEnd())
 		{
 			ReportError(Peek().Location, ExpectedMessage("EOF"));
 		}
-
-		if (errors.size() == 0)
-		{
-			return {rootNode, errors};
-		}
-		return {std::make_shared<node::Text>("Parsing failed", UnknownLocation()), errors};
+		return rootNode;
 	}
 
-	std::shared_ptr<Node> ParseGroup()
+	NodeIndex ParseGroup()
 	{
 		auto start = Peek().Location;
-		auto nodes = std::vector<std::shared_ptr<Node>>();
+		const auto first_pending = pending->size();
 		while (! IsAtEnd()
 			   && ! (Peek().Type == TokenType::BeginCode && PeekNext() == TokenType::KeywordEnd))
 		{
 			try
 			{
-				ParseNode(nodes);
+				ParseNode();
 			}
 			catch (const ParseError&)
 			{
@@ -282,7 +359,18 @@ struct Parser
 			}
 		}
 
-		return std::make_shared<node::Group>(nodes, start);
+		const auto group = node::Group{
+			static_cast<std::uint32_t>(ast->Members.size()),
+			static_cast<std::uint32_t>(pending->size() - first_pending),
+			start
+		};
+		ast->Members.insert(
+			ast->Members.end(),
+			pending->begin() + static_cast<std::ptrdiff_t>(first_pending),
+			pending->end()
+		);
+		pending->resize(first_pending);
+		return ast->Add(group);
 	}
 
 	ParseError ReportError(Location loc, std::string message)
@@ -382,13 +470,13 @@ struct Parser
 		}
 
 		auto arg = Advance();
-		return FuncArgument(arg.Location, arg.Value);
+		return FuncArgument(arg.Location, std::string{arg.Value});
 	}
 
 	std::string ExtractAttributeName()
 	{
 		auto ident = Consume(TokenType::Ident, ExpectedMessage("IDENT"));
-		return ident.Value;
+		return std::string{ident.Value};
 	}
 
 	std::string ExpectedMessage(std::string what)
@@ -396,7 +484,7 @@ struct Parser
 		return Fmt{} << "Expected " << what << " but found " << TokenToMessage(Peek());
 	}
 
-	void ParseNode(std::vector<std::shared_ptr<Node>>& nodes)
+	void ParseNode()
 	{
 		switch (Peek().Type)
 		{
@@ -415,7 +503,7 @@ struct Parser
 					Consume(TokenType::KeywordEnd, ExpectedMessage("keyword end"));
 					Consume(TokenType::EndCode, ExpectedMessage("}}"));
 
-					nodes.emplace_back(std::make_shared<node::Iterate>(attribute, group, start));
+					pending->emplace_back(ast->Add(node::Iterate{attribute, group, start}));
 				}
 				else if (Match(TokenType::KeywordIf))
 				{
@@ -427,71 +515,28 @@ struct Parser
 					Consume(TokenType::KeywordEnd, ExpectedMessage("keyword end"));
 					Consume(TokenType::EndCode, ExpectedMessage("}}"));
 
-					nodes.emplace_back(std::make_shared<node::If>(attribute, group, start));
+					pending->emplace_back(ast->Add(node::If{attribute, group, start}));
 				}
 				else if (Match(TokenType::KeywordInclude))
 				{
-					auto name = Consume(TokenType::Ident, ExpectedMessage("IDENT"));
+					auto name = std::string{
+						Consume(TokenType::Ident, ExpectedMessage("IDENT")).Value
+					};
 					auto includeLocation = Peek().Location;
 					Consume(TokenType::EndCode, ExpectedMessage("}}"));
 
-					auto firstFile = includeDir->GetFile(name.Value);
-					auto file = firstFile;
-					auto secondFile = firstFile;
-					if (vfs->Exists(file) == false)
-					{
-						secondFile = includeDir->GetFile(name.Value + defaultExtension);
-						file = secondFile;
-					}
-
-					if (vfs->Exists(file) == false)
-					{
-						ReportError(
-							includeLocation,
-							Fmt{} << "Unable to open file: tried " << firstFile << " and "
-								  << secondFile
-						);
-					}
-					else
-					{
-						auto source = vfs->ReadAllText(file);
-						auto [scannerTokens, lexerErrors] = Scan(file, source);
-						if (lexerErrors.size() > 0)
-						{
-							ReportError(includeLocation, "included from here...");
-							for (auto e: lexerErrors)
-							{
-								ReportError(e.Location, e.Message);
-							}
-							return;
-						}
-
-						auto [node, parseErrors]
-							= Parse(scannerTokens, functions, includeDir, defaultExtension, vfs);
-						if (parseErrors.size() > 0)
-						{
-							ReportError(includeLocation, "included from here...");
-							for (auto e: parseErrors)
-							{
-								ReportError(e.Location, e.Message);
-							}
-
-							return;
-						}
-
-						nodes.emplace_back(node);
-					}
+					ParseInclude(name, includeLocation);
 				}
 				else
 				{
-					ParseAttributeToEnd(nodes);
+					ParseAttributeToEnd();
 				}
 			}
 			break;
 		case TokenType::Text:
 			{
 				auto text = Advance();
-				nodes.emplace_back(std::make_shared<node::Text>(text.Value, text.Location));
+				pending->emplace_back(ast->Add(node::Text{std::string{text.Value}, text.Location}));
 			}
 			break;
 		default:
@@ -501,16 +546,192 @@ struct Parser
 		}
 	}
 
-	void ParseAttributeToEnd(std::vector<std::shared_ptr<Node>>& nodes)
+	void ParseInclude(const std::string& name, const Location& includeLocation)
+	{
+		auto* includeDir = context->includeDir;
+		auto* vfs = context->vfs;
+
+		auto firstFile = includeDir->GetFile(name);
+		auto secondFile = includeDir->GetFile(name + context->defaultExtension);
+
+		// files being parsed or parsed earlier in this parse are known to exist
+		const auto& stack = context->includeStack;
+		const auto exists = [&](const std::string& candidate)
+		{
+			return std::find(stack.begin(), stack.end(), candidate) != stack.end()
+				|| context->included.contains(candidate) || vfs->Exists(candidate);
+		};
+		auto file = firstFile;
+		if (exists(file) == false)
+		{
+			file = secondFile;
+		}
+
+		if (exists(file) == false)
+		{
+			ReportError(
+				includeLocation,
+				Fmt{} << "Unable to open file: tried " << firstFile << " and " << secondFile
+			);
+			return;
+		}
+
+		if (std::find(stack.begin(), stack.end(), file) != stack.end())
+		{
+			ReportError(includeLocation, Fmt{} << "Include cycle: " << IncludeChain(file));
+			return;
+		}
+
+		if (static_cast<int>(context->includeStack.size()) > context->maxIncludeDepth)
+		{
+			ReportError(
+				includeLocation,
+				Fmt{} << "Include depth exceeds " << context->maxIncludeDepth << ": "
+					  << IncludeChain(file)
+			);
+			return;
+		}
+
+		// already parsed, no need to read it again
+		if (const auto* parsed = FindParsed(file); parsed != nullptr)
+		{
+			AddInclude(file, *parsed);
+			pending->emplace_back(parsed->Root);
+			return;
+		}
+
+		const auto source = vfs->ReadSource(file);
+		if (source.Error.empty() == false)
+		{
+			ReportError(
+				includeLocation, Fmt{} << "Unable to read " << file << ": " << source.Error
+			);
+			return;
+		}
+
+		auto [scannerTokens, lexerErrors] = Scan(file, source.Text, context->memory);
+		if (lexerErrors.size() > 0)
+		{
+			ReportError(includeLocation, "included from here...");
+			for (auto e: lexerErrors)
+			{
+				ReportError(e.Location, e.Message);
+			}
+			return;
+		}
+
+		context->includeStack.emplace_back(file);
+		auto included = Parser{scannerTokens, context};
+		const auto root = included.parse();
+		context->includeStack.pop_back();
+		if (included.errors.size() > 0)
+		{
+			ReportError(includeLocation, "included from here...");
+			for (auto e: included.errors)
+			{
+				ReportError(e.Location, e.Message);
+			}
+
+			return;
+		}
+
+		auto& parsed = context->included[file];
+		parsed = IncludedFile{root, std::move(included.includes), included.includeDepth};
+		AddInclude(file, parsed);
+		if (context->cache != nullptr)
+		{
+			// the cache outlives this parse so the copy uses the default resource
+			auto copy = std::make_shared<CachedInclude>();
+			copy->Nodes.Root = CopyNodes(*ast, root, &copy->Nodes);
+			copy->Includes = parsed.Includes;
+			copy->Depth = parsed.Depth;
+			context->cache->Add(file, std::move(copy));
+		}
+
+		pending->emplace_back(root);
+	}
+
+	void AddInclude(const std::string& file, const IncludedFile& parsed)
+	{
+		for (const auto& f: parsed.Includes)
+		{
+			if (std::find(includes.begin(), includes.end(), f) == includes.end())
+			{
+				includes.emplace_back(f);
+			}
+		}
+		if (std::find(includes.begin(), includes.end(), file) == includes.end())
+		{
+			includes.emplace_back(file);
+		}
+		includeDepth = std::max(includeDepth, parsed.Depth + 1);
+	}
+
+	// a file parsed earlier is only reused if parsing it again here would give the same result,
+	// that is if none of its includes are being parsed and they don't nest too deep
+	bool CanReuse(const std::vector<std::string>& nested, int depth) const
+	{
+		const auto& stack = context->includeStack;
+		if (static_cast<int>(stack.size()) + depth > context->maxIncludeDepth)
+		{
+			return false;
+		}
+		return std::none_of(
+			nested.begin(),
+			nested.end(),
+			[&stack](const std::string& f)
+			{ return std::find(stack.begin(), stack.end(), f) != stack.end(); }
+		);
+	}
+
+	// the current include stack and the next file, formatted as a -> b -> c
+	std::string IncludeChain(const std::string& next) const
+	{
+		auto ss = Fmt{};
+		for (const auto& file: context->includeStack)
+		{
+			ss << file << " -> ";
+		}
+		ss << next;
+		return ss;
+	}
+
+	// a file parsed earlier in this parse or by a earlier build, null if it needs to be parsed
+	const IncludedFile* FindParsed(const std::string& file)
+	{
+		if (const auto found = context->included.find(file); found != context->included.end())
+		{
+			const auto& parsed = found->second;
+			return CanReuse(parsed.Includes, parsed.Depth) ? &parsed : nullptr;
+		}
+
+		if (context->cache == nullptr)
+		{
+			return nullptr;
+		}
+
+		const auto cached = context->cache->Find(file);
+		if (cached == nullptr || CanReuse(cached->Includes, cached->Depth) == false)
+		{
+			return nullptr;
+		}
+
+		const auto root = CopyNodes(cached->Nodes, cached->Nodes.Root, ast);
+		auto& parsed = context->included[file];
+		parsed = IncludedFile{root, cached->Includes, cached->Depth};
+		return &parsed;
+	}
+
+	void ParseAttributeToEnd()
 	{
 		auto start = Peek().Location;
-		std::shared_ptr<Node> node
-			= std::make_shared<node::Attribute>(ExtractAttributeName(), start);
+		NodeIndex expression = ast->Add(node::Attribute{ExtractAttributeName(), start});
 
 		while (Peek().Type == TokenType::Pipe)
 		{
 			Advance();
 			auto name = Consume(TokenType::Ident, ExpectedMessage("function name"));
+			auto function_name = std::string{name.Value};
 			auto arguments = std::vector<FuncArgument>();
 
 			if (Match(TokenType::LeftParen))
@@ -531,7 +752,7 @@ struct Parser
 				Consume(TokenType::RightParen, ExpectedMessage(") to end function"));
 			}
 
-			if (auto funcGenerator = functions.find(name.Value); funcGenerator != functions.end())
+			if (auto funcGenerator = functions.find(function_name); funcGenerator != functions.end())
 			{
 				auto [func, funcParseErrors] = funcGenerator->second(name.Location, arguments);
 				if (funcParseErrors.empty() == false)
@@ -541,32 +762,105 @@ struct Parser
 						ReportError(err.Location, err.Message);
 					}
 				}
-				node = std::make_shared<node::FunctionCall>(name.Value, func, node, name.Location);
+				expression = ast->Add(
+					node::FunctionCall{function_name, arguments, func, expression, name.Location}
+				);
 			}
 			else
 			{
 				ReportError(
 					name.Location,
-					Fmt{} << "Unknown function named " << name.Value << ": "
-						  << MatchStrings(name.Value, GetKeys(functions))
+					Fmt{} << "Unknown function named " << function_name << ": "
+						  << MatchStrings(function_name, GetKeys(functions))
 				);
 			}
 		}
-		nodes.emplace_back(node);
+		pending->emplace_back(expression);
 
 		Consume(TokenType::EndCode, ExpectedMessage("end token"));
 	}
 };
 
 ParseResult Parse(
-	std::vector<Token> itok,
-	std::unordered_map<std::string, FuncGenerator> functions,
+	std::span<const Token> itok,
+	const std::unordered_map<std::string, FuncGenerator>& functions,
 	DirectoryInfo* includeDir,
 	std::string defaultExtension,
-	VfsRead* vfs
+	VfsRead* vfs,
+	IncludeCache* cache,
+	int maxIncludeDepth,
+	std::pmr::memory_resource* memory
+)
+{
+	auto ast = Ast{memory};
+	ast.Nodes.reserve(itok.size());
+
+	auto context = ParseContext{
+		&functions,
+		includeDir,
+		std::move(defaultExtension),
+		vfs,
+		cache,
+		maxIncludeDepth,
+		memory,
+		&ast
+	};
+	if (itok.empty() == false)
+	{
+		context.includeStack.emplace_back(itok.back().Location.File);
+	}
+	Parser parser{itok, &context};
+	ast.Root = parser.parse();
+	if (parser.errors.empty())
+	{
+		return {std::move(ast), parser.errors};
+	}
+
+	auto failed = Ast{};
+	failed.Root = failed.Add(node::Text{"Parsing failed", UnknownLocation()});
+	return {std::move(failed), parser.errors};
+}
+
+ParseResult ParseFile(
+	const std::string& path,
+	VfsRead* vfs,
+	DirectoryInfo* includeDir,
+	const std::unordered_map<std::string, FuncGenerator>& functions,
+	IncludeCache* cache,
+	int maxIncludeDepth,
+	PhaseMemory* memory
 )
 {
-	Parser parser{itok, functions, includeDir, defaultExtension, vfs};
-	return parser.parse();
+	auto* scan_memory = memory != nullptr ? &memory->Scan : std::pmr::get_default_resource();
+	auto* parse_memory = memory != nullptr ? &memory->Parse : std::pmr::get_default_resource();
+
+	// the tokens refer to the source, the parsed nodes own their text
+	const auto source = vfs->ReadSource(path);
+	if (source.Error.empty() == false)
+	{
+		auto failed = Ast{};
+		failed.Root = failed.Add(node::Text{"Reading failed", UnknownLocation()});
+		const std::string message = Fmt{} << "Unable to read " << path << ": " << source.Error;
+		return {std::move(failed), {Error{Location{path, -1, -1}, message}}};
+	}
+
+	auto [tokens, lexerErrors] = Scan(path, source.Text, scan_memory);
+	if (lexerErrors.size() > 0)
+	{
+		auto failed = Ast{};
+		failed.Root = failed.Add(node::Text{"Lexing failed", UnknownLocation()});
+		return {std::move(failed), lexerErrors};
+	}
+
+	return Parse(
+		tokens,
+		functions,
+		includeDir,
+		vfs->GetExtension(path),
+		vfs,
+		cache,
+		maxIncludeDepth,
+		parse_memory
+	);
 }
 }  //  namespace forma
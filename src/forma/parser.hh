@@ -1,130 +1,157 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
 #include <stdexcept>
+#include <variant>
 
 #include "forma/core.hh"
+#include "forma/memory.hh"
 #include "forma/scanner.hh"
 
 namespace forma
 {
-namespace node
-{
-	struct Text;
-	struct Attribute;
-	struct Iterate;
-	struct If;
-	struct FunctionCall;
-	struct Group;
-}  //  namespace node
-
-struct Node
-{
-	virtual ~Node() = default;
-
-	virtual node::Text* AsText()
-	{
-		return nullptr;
-	}
-
-	virtual node::Attribute* AsAttribute()
-	{
-		return nullptr;
-	}
-
-	virtual node::Iterate* AsIterate()
-	{
-		return nullptr;
-	}
-
-	virtual node::If* AsIf()
-	{
-		return nullptr;
-	}
-
-	virtual node::FunctionCall* AsFunctionCall()
-	{
-		return nullptr;
-	}
-
-	virtual node::Group* AsGroup()
-	{
-		return nullptr;
-	}
-};
+// nodes refer to each other by their index in the owning Ast
+using NodeIndex = std::uint32_t;
 
 namespace node
 {
-	struct Text : Node
+	struct Text
 	{
-		Text(std::string v, forma::Location l);
 		std::string Value;
 		forma::Location Location;
-
-		Text* AsText() override;
 	};
 
-	struct Attribute : Node
+	struct Attribute
 	{
-		Attribute(std::string Name, forma::Location Location);
-
 		std::string Name;
 		forma::Location Location;
-
-		Attribute* AsAttribute() override;
 	};
 
-	struct Iterate : Node
+	struct Iterate
 	{
-		Iterate(std::string n, std::shared_ptr<Node> b, forma::Location l);
-
 		std::string Name;
-		std::shared_ptr<Node> Body;
+		NodeIndex Body;
 		forma::Location Location;
-
-		Iterate* AsIterate() override;
 	};
 
-	struct If : Node
+	struct If
 	{
-		If(std::string n, std::shared_ptr<Node> b, forma::Location l);
 		std::string Name;
-		std::shared_ptr<Node> Body;
+		NodeIndex Body;
 		forma::Location Location;
-
-		If* AsIf() override;
 	};
 
-	struct FunctionCall : Node
+	struct FunctionCall
 	{
-		FunctionCall(std::string n, Func f, std::shared_ptr<Node> a, forma::Location l);
-
 		std::string Name;
+		std::vector<FuncArgument> Arguments;
 		Func Function;
-		std::shared_ptr<Node> Arg;
+		NodeIndex Arg;
 		forma::Location Location;
-
-		FunctionCall* AsFunctionCall() override;
 	};
 
-	struct Group : Node
+	// the members are stored contiguous in Ast::Members
+	struct Group
 	{
-		Group(std::vector<std::shared_ptr<Node>> n, forma::Location l);
-
-		std::vector<std::shared_ptr<Node>> Nodes;
+		std::uint32_t First;
+		std::uint32_t Count;
 		forma::Location Location;
-
-		Group* AsGroup() override;
 	};
 }  //  namespace node
 
-using ParseResult = std::pair<std::shared_ptr<Node>, std::vector<Error>>;
+using Node = std::variant<
+	node::Text,
+	node::Attribute,
+	node::Iterate,
+	node::If,
+	node::FunctionCall,
+	node::Group>;
+
+// all nodes of a single parse, including the included files
+// the node and member tables are allocated from the memory resource, the node strings are not
+struct Ast
+{
+	std::pmr::vector<Node> Nodes;
+	std::pmr::vector<NodeIndex> Members;
+	NodeIndex Root = 0;
+
+	Ast() = default;
+	explicit Ast(std::pmr::memory_resource* memory);
+
+	NodeIndex Add(Node n);
+
+	const Node& operator[](NodeIndex index) const;
+	std::span<const NodeIndex> MembersOf(const node::Group& group) const;
+
+	// the files the nodes were parsed from, the root file and all included files
+	std::vector<std::string> Files() const;
+};
+
+// copies the root and everything below it, returns the new root
+NodeIndex CopyNodes(const Ast& from, NodeIndex root, Ast* to);
+
+// a parsed include file
+// what it includes is kept so a build can check it against its own include chain and depth
+struct CachedInclude
+{
+	Ast Nodes;
+	std::vector<std::string> Includes;  // the files it includes, directly or not
+	int Depth = 0;  // how many levels of includes are nested below it
+};
+
+// Parsed include files, keyed by the resolved path.
+// Share between builds to only scan and parse each include once, but only between builds
+// that use the same functions since the parsed function calls are stored.
+// A cached file that would be a include cycle or nest too deep in a build is parsed again.
+class IncludeCache
+{
+   public:
+
+	std::shared_ptr<const CachedInclude> Find(const std::string& path) const;
+	void Add(const std::string& path, std::shared_ptr<const CachedInclude> include);
+
+	// forget a changed file and all files that include it
+	void Invalidate(const std::string& path);
+	void Clear();
+
+   private:
+
+	mutable std::mutex mutex;
+	std::unordered_map<std::string, std::shared_ptr<const CachedInclude>> parsed;
+};
+
+constexpr int DefaultMaxIncludeDepth = 32;
+
+// within a single parse each included file is only parsed once, the cache is optional
+// include cycles and includes nested deeper than the max depth are reported as errors
+// the ast and the parsers temporaries are allocated from the memory resource
+using ParseResult = std::pair<Ast, std::vector<Error>>;
 ParseResult Parse(
-	std::vector<Token> itok,
-	std::unordered_map<std::string, FuncGenerator> functions,
+	std::span<const Token> itok,
+	const std::unordered_map<std::string, FuncGenerator>& functions,
 	DirectoryInfo* includeDir,
 	std::string defaultExtension,
-	VfsRead* vfs
+	VfsRead* vfs,
+	IncludeCache* cache = nullptr,
+	int maxIncludeDepth = DefaultMaxIncludeDepth,
+	std::pmr::memory_resource* memory = std::pmr::get_default_resource()
+);
+
+// read, scan and parse a file
+// on errors the ast is a single text node describing what failed
+// the scan and the parse are counted in the phase memory if there is one
+ParseResult ParseFile(
+	const std::string& path,
+	VfsRead* vfs,
+	DirectoryInfo* includeDir,
+	const std::unordered_map<std::string, FuncGenerator>& functions,
+	IncludeCache* cache = nullptr,
+	int maxIncludeDepth = DefaultMaxIncludeDepth,
+	PhaseMemory* memory = nullptr
 );
 
 }  //  namespace forma
@@ -0,0 +1,172 @@
+#include "forma/profiler.hh"
+
+#include <algorithm>
+#include <map>
+
+namespace forma
+{
+Profiler::Profiler()
+{
+	frames.emplace_back(Frame{nullptr, 0, "", "", SourceKind::Text, "", {}});
+}
+
+bool Profiler::Active() const
+{
+	return stack.empty() == false;
+}
+
+void Profiler::Begin(const SourceInfo* source)
+{
+	const auto parent = stack.empty() ? 0 : stack.back().Frame;
+
+	const auto [found, inserted] = lookup.try_emplace(FrameKey{parent, source}, 0);
+	if (inserted)
+	{
+		auto label = source->Kind == SourceKind::Function ? "| " + source->Name : source->Name;
+		label = Fmt{} << label << " (" << source->Location << ")";
+		std::replace(label.begin(), label.end(), ';', ':');
+
+		found->second = static_cast<std::uint32_t>(frames.size());
+		frames.emplace_back(Frame{
+			source,
+			parent,
+			std::move(label),
+			std::string{source->Location.File},
+			source->Kind,
+			source->Name,
+			{}
+		});
+	}
+
+	stack.emplace_back(Scope{found->second, Clock::now(), bytes});
+}
+
+void Profiler::End()
+{
+	const auto scope = stack.back();
+	stack.pop_back();
+
+	const auto elapsed = static_cast<std::uint64_t>(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - scope.Start).count()
+	);
+	const auto written = bytes - scope.Bytes;
+
+	auto& stats = frames[scope.Frame].Stats;
+	stats.Calls += 1;
+	stats.Nanoseconds += elapsed - std::min(elapsed, scope.ChildNanoseconds);
+	stats.Bytes += written - scope.ChildBytes;
+
+	if (stack.empty() == false)
+	{
+		stack.back().ChildNanoseconds += elapsed;
+		stack.back().ChildBytes += written;
+	}
+}
+
+void Profiler::CountBytes(std::size_t count)
+{
+	bytes += count;
+}
+
+template<typename F>
+std::vector<std::pair<std::string, ProfileStats>> Profiler::GroupBy(F&& key) const
+{
+	std::map<std::string, ProfileStats> groups;
+	for (std::size_t index = 1; index < frames.size(); index += 1)
+	{
+		const auto& frame = frames[index];
+		const auto name = key(frame);
+		if (name.empty()) continue;
+
+		auto& group = groups[name];
+		group.Calls += frame.Stats.Calls;
+		group.Nanoseconds += frame.Stats.Nanoseconds;
+		group.Bytes += frame.Stats.Bytes;
+	}
+
+	auto sorted = std::vector<std::pair<std::string, ProfileStats>>{groups.begin(), groups.end()};
+	std::stable_sort(
+		sorted.begin(),
+		sorted.end(),
+		[](const auto& lhs, const auto& rhs)
+		{ return lhs.second.Nanoseconds > rhs.second.Nanoseconds; }
+	);
+	return sorted;
+}
+
+std::vector<std::pair<std::string, ProfileStats>> Profiler::ByNode() const
+{
+	return GroupBy([](const Frame& frame) { return frame.Label; });
+}
+
+std::vector<std::pair<std::string, ProfileStats>> Profiler::ByFile() const
+{
+	return GroupBy([](const Frame& frame) { return frame.File; });
+}
+
+std::vector<std::pair<std::string, ProfileStats>> Profiler::ByFunction() const
+{
+	return GroupBy([](const Frame& frame)
+				   { return frame.Kind == SourceKind::Function ? frame.Name : std::string{}; });
+}
+
+std::string Profiler::Report() const
+{
+	auto report = Fmt{};
+	const auto section = [&report](const std::string& title, const auto& groups)
+	{
+		report << title << "\n";
+		report << "  calls\tself us\tbytes\tname\n";
+		for (const auto& [name, stats]: groups)
+		{
+			report << "  " << stats.Calls << "\t" << stats.Nanoseconds / 1000 << "\t"
+				   << stats.Bytes << "\t" << name << "\n";
+		}
+	};
+	section("nodes", ByNode());
+	section("files", ByFile());
+	section("functions", ByFunction());
+	return report;
+}
+
+std::string Profiler::CollapsedStacks() const
+{
+	auto collapsed = Fmt{};
+	for (std::size_t index = 1; index < frames.size(); index += 1)
+	{
+		const auto& frame = frames[index];
+		if (frame.Stats.Calls == 0) continue;
+
+		std::vector<const std::string*> labels;
+		for (auto at = index; at != 0; at = frames[at].Parent)
+		{
+			labels.emplace_back(&frames[at].Label);
+		}
+
+		for (auto label = labels.rbegin(); label != labels.rend(); ++label)
+		{
+			if (label != labels.rbegin()) collapsed << ";";
+			collapsed << **label;
+		}
+		collapsed << " " << frame.Stats.Nanoseconds / 1000 << "\n";
+	}
+	return collapsed;
+}
+
+CountingSink::CountingSink(Sink* t, Profiler* p)
+	: target(t)
+	, profiler(p)
+{
+}
+
+void CountingSink::Write(std::string_view text)
+{
+	profiler->CountBytes(text.size());
+	target->Write(text);
+}
+
+void CountingSink::Reserve(std::size_t size)
+{
+	target->Reserve(size);
+}
+}  //  namespace forma
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "forma/core.hh"
+
+namespace forma
+{
+enum class SourceKind : std::uint8_t
+{
+	Text,
+	Attribute,
+	If,
+	Range,
+	Function,
+};
+
+// where a instruction came from, recorded when a template is compiled
+struct SourceInfo
+{
+	forma::Location Location = UnknownLocation();
+	SourceKind Kind = SourceKind::Text;
+	std::string Name;
+};
+
+struct ProfileStats
+{
+	std::uint64_t Calls = 0;
+	std::uint64_t Nanoseconds = 0;  // self time, time spent in nested lists is not included
+	std::uint64_t Bytes = 0;  // bytes written to the output, excluding nested lists
+};
+
+// Collects the time and output size of each instruction of profiled renders.
+// The measurements are kept per call stack, a range is the parent of the instructions in its
+// body. A profiler can be reused for several renders but only by one thread at a time.
+class Profiler
+{
+   public:
+
+	Profiler();
+
+	// a flat report of the nodes, files and functions sorted on the self time
+	std::string Report() const;
+
+	// one line per call stack with the self time in microseconds, for flamegraph.pl
+	std::string CollapsedStacks() const;
+
+	// the total of the measurements, grouped on a label, sorted on the self time
+	std::vector<std::pair<std::string, ProfileStats>> ByNode() const;
+	std::vector<std::pair<std::string, ProfileStats>> ByFile() const;
+	std::vector<std::pair<std::string, ProfileStats>> ByFunction() const;
+
+	// called while rendering
+	bool Active() const;
+	void Begin(const SourceInfo* source);
+	void End();
+	void CountBytes(std::size_t bytes);
+
+   private:
+
+	using Clock = std::chrono::steady_clock;
+
+	struct Frame
+	{
+		const SourceInfo* Source;
+		std::uint32_t Parent;
+		std::string Label;
+		std::string File;
+		SourceKind Kind;
+		std::string Name;
+		ProfileStats Stats;
+	};
+
+	// a frame is a source called from a parent frame
+	struct FrameKey
+	{
+		std::uint32_t Parent;
+		const SourceInfo* Source;
+
+		bool operator==(const FrameKey& rhs) const = default;
+	};
+
+	struct FrameKeyHash
+	{
+		std::size_t operator()(const FrameKey& key) const
+		{
+			return std::hash<const SourceInfo*>{}(key.Source) * 31 + key.Parent;
+		}
+	};
+
+	struct Scope
+	{
+		std::uint32_t Frame;
+		Clock::time_point Start;
+		std::uint64_t Bytes;
+		std::uint64_t ChildNanoseconds = 0;
+		std::uint64_t ChildBytes = 0;
+	};
+
+	template<typename F>
+	std::vector<std::pair<std::string, ProfileStats>> GroupBy(F&& key) const;
+
+	std::vector<Frame> frames;  // the first frame is the root of all stacks
+	std::unordered_map<FrameKey, std::uint32_t, FrameKeyHash> lookup;  // index of each frame
+	std::vector<Scope> stack;
+	std::uint64_t bytes = 0;
+};
+
+// forwards to the target and counts the bytes written
+struct CountingSink : Sink
+{
+	CountingSink(Sink* t, Profiler* p);
+	void Write(std::string_view text) override;
+	void Reserve(std::size_t size) override;
+
+	Sink* target;
+	Profiler* profiler;
+};
+}  //  namespace forma
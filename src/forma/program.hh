@@ -0,0 +1,233 @@
+#pragma once
+
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+#include "forma/core.hh"
+#include "forma/profiler.hh"
+
+namespace forma
+{
+// the instructions a validated template is compiled to
+enum class OpCode : std::uint8_t
+{
+	EmitText,  // write Text[A, A+B)
+	EmitAttribute,  // write Attributes[A]
+	EmitMember,  // write Members[A]
+	EmitList,  // render Lists[A]
+	JumpIfFalse,  // if Bools[A] is false, continue at B
+	BeginCapture,  // redirect output to a new capture buffer
+	CallFunction,  // end the capture, apply Functions[A] and write the result
+	ApplyToAttribute,  // apply Functions[A] to the value of Attributes[B] and write the result
+};
+
+struct Instruction
+{
+	OpCode Op;
+	std::uint32_t A;
+	std::uint32_t B;
+};
+
+// renders a list, the profiler may be null
+template<typename T>
+using ListFunction = std::function<void(const T&, Sink&, Profiler*, std::pmr::memory_resource*)>;
+
+// a flat list of instructions and the tables they refer to
+// the tables are allocated from the memory resource given when the program is created
+template<typename T>
+struct Program
+{
+	std::pmr::vector<Instruction> Code;
+	std::pmr::string Text;  // all static text, EmitText refers to slices of this
+	std::pmr::vector<std::function<Value(const T&)>> Attributes;
+	std::pmr::vector<void (*)(const T&, Sink&)> Members;  // bound at compile time, writes directly
+	std::pmr::vector<std::function<bool(const T&)>> Bools;
+	std::pmr::vector<ListFunction<T>> Lists;
+	std::pmr::vector<Func> Functions;
+	std::uint32_t LastTarget = 0;  // texts before and after a jump target can't be merged
+	std::pmr::vector<SourceInfo> Sources;  // one entry per compiled node, for the profiler
+	std::pmr::vector<std::uint32_t> SourceIndex;  // the entry in Sources of each instruction
+	std::uint32_t Current = 0;  // the entry in Sources of the instructions that are emitted next
+
+	Program() = default;
+
+	explicit Program(std::pmr::memory_resource* memory)
+		: Code(memory)
+		, Text(memory)
+		, Attributes(memory)
+		, Members(memory)
+		, Bools(memory)
+		, Lists(memory)
+		, Functions(memory)
+		, Sources(memory)
+		, SourceIndex(memory)
+	{
+	}
+
+	// the source of the instructions that are emitted next, returns the entry to restore it
+	std::uint32_t AddSource(SourceInfo source)
+	{
+		Sources.emplace_back(std::move(source));
+		Current = static_cast<std::uint32_t>(Sources.size() - 1);
+		return Current;
+	}
+
+	std::uint32_t Emit(OpCode op, std::uint32_t a = 0, std::uint32_t b = 0)
+	{
+		if (Sources.empty())
+		{
+			AddSource({});
+		}
+		Code.emplace_back(Instruction{op, a, b});
+		SourceIndex.emplace_back(Current);
+		return static_cast<std::uint32_t>(Code.size() - 1);
+	}
+
+	std::uint32_t Here() const
+	{
+		return static_cast<std::uint32_t>(Code.size());
+	}
+
+	// the current position as the destination of a jump
+	std::uint32_t JumpTarget()
+	{
+		LastTarget = Here();
+		return LastTarget;
+	}
+
+	// Add static text.
+	// Adjacent texts are merged into a single instruction unless a jump lands in between.
+	void EmitText(std::string_view text)
+	{
+		if (text.empty()) return;
+
+		const auto offset = static_cast<std::uint32_t>(Text.size());
+		const auto size = static_cast<std::uint32_t>(text.size());
+		Text += text;
+
+		if (Code.empty() == false && Here() != LastTarget)
+		{
+			auto& last = Code.back();
+			if (last.Op == OpCode::EmitText && last.A + last.B == offset)
+			{
+				last.B += size;
+				return;
+			}
+		}
+		Emit(OpCode::EmitText, offset, size);
+	}
+
+	// all state is local so a program can be run from several threads at once
+	// the temporaries of the run are allocated from the memory resource
+	void Run(
+		const T& t,
+		Sink& sink,
+		std::pmr::memory_resource* memory = std::pmr::get_default_resource()
+	) const
+	{
+		Execute<false>(t, sink, nullptr, memory);
+	}
+
+	// measure each instruction, the profiler can only be used by one thread at a time
+	void Run(
+		const T& t,
+		Sink& sink,
+		Profiler* profiler,
+		std::pmr::memory_resource* memory = std::pmr::get_default_resource()
+	) const
+	{
+		if (profiler->Active())
+		{
+			// a nested list, the output is already counted
+			Execute<true>(t, sink, profiler, memory);
+			return;
+		}
+
+		CountingSink counting{&sink, profiler};
+		Execute<true>(t, counting, profiler, memory);
+	}
+
+   private:
+
+	// the profiling is decided at compile time so a normal run doesn't pay for it
+	template<bool Profiled>
+	void Execute(
+		const T& t, Sink& sink, Profiler* profiler, std::pmr::memory_resource* memory
+	) const
+	{
+		// function arguments, reused within a render
+		std::pmr::vector<std::pmr::string> captures{memory};
+		std::size_t depth = 0;
+		PmrStringSink capture_sink{nullptr};
+
+		const auto out = [&]() -> Sink&
+		{
+			if (depth == 0) return sink;
+			capture_sink.target = &captures[depth - 1];
+			return capture_sink;
+		};
+
+		const auto text = std::string_view{Text};
+		const auto size = Code.size();
+		for (std::size_t pc = 0; pc < size;)
+		{
+			const auto& in = Code[pc];
+			if constexpr (Profiled)
+			{
+				profiler->Begin(&Sources[SourceIndex[pc]]);
+			}
+			pc += 1;
+			switch (in.Op)
+			{
+			case OpCode::EmitText: out().Write(text.substr(in.A, in.B)); break;
+			case OpCode::EmitAttribute: WriteValue(Attributes[in.A](t), out()); break;
+			case OpCode::EmitMember: Members[in.A](t, out()); break;
+			case OpCode::EmitList: Lists[in.A](t, out(), profiler, memory); break;
+			case OpCode::JumpIfFalse:
+				if (Bools[in.A](t) == false)
+				{
+					pc = in.B;
+				}
+				break;
+			case OpCode::BeginCapture:
+				if (depth == captures.size())
+				{
+					captures.emplace_back();
+				}
+				else
+				{
+					captures[depth].clear();
+				}
+				depth += 1;
+				break;
+			case OpCode::CallFunction:
+				{
+					depth -= 1;
+					const auto argument = Value{std::string_view{captures[depth]}};
+					Functions[in.A](argument, out());
+				}
+				break;
+			case OpCode::ApplyToAttribute: Functions[in.A](Attributes[in.B](t), out()); break;
+			}
+
+			if constexpr (Profiled)
+			{
+				profiler->End();
+			}
+		}
+	}
+};
+
+// a program that ignores the input and just writes the text
+template<typename T>
+Program<T> TextProgram(std::string_view text)
+{
+	Program<T> program;
+	program.EmitText(text);
+	return program;
+}
+}  //  namespace forma
@@ -0,0 +1,74 @@
+#include "forma/registry.hh"
+
+#include <algorithm>
+#include <filesystem>
+#include <string_view>
+
+namespace forma
+{
+StampingRead::StampingRead(VfsRead* v, ChangeCheck* c)
+	: vfs(v)
+	, check(c)
+{
+}
+
+std::string StampingRead::ReadAllText(const std::string& path)
+{
+	StampOnce(path);
+	return vfs->ReadAllText(path);
+}
+
+bool StampingRead::Exists(const std::string& path)
+{
+	return vfs->Exists(path);
+}
+
+std::string StampingRead::GetExtension(const std::string& file_path)
+{
+	return vfs->GetExtension(file_path);
+}
+
+SourceText StampingRead::ReadSource(const std::string& path)
+{
+	StampOnce(path);
+	return vfs->ReadSource(path);
+}
+
+void StampingRead::StampOnce(const std::string& path)
+{
+	const auto stamped = std::find_if(
+		stamps.begin(), stamps.end(), [&path](const auto& stamp) { return stamp.first == path; }
+	);
+	if (stamped == stamps.end())
+	{
+		stamps.emplace_back(path, check->Stamp(path));
+	}
+}
+
+ContentHashCheck::ContentHashCheck(VfsRead* v)
+	: vfs(v)
+{
+}
+
+std::string ContentHashCheck::Stamp(const std::string& path)
+{
+	if (vfs->Exists(path) == false)
+	{
+		return "";
+	}
+
+	const auto text = vfs->ReadAllText(path);
+	return std::to_string(std::hash<std::string_view>{}(text));
+}
+
+std::string ModificationTimeCheck::Stamp(const std::string& path)
+{
+	std::error_code error;
+	const auto time = std::filesystem::last_write_time(path, error);
+	if (error)
+	{
+		return "";
+	}
+	return std::to_string(time.time_since_epoch().count());
+}
+}  //  namespace forma
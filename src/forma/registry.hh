@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "forma/core.hh"
+#include "forma/template.hh"
+
+namespace forma
+{
+// detects if a file has changed since a template was built from it
+struct ChangeCheck
+{
+	virtual ~ChangeCheck() = default;
+
+	// a value that differs when the file has changed, like a modification time or a hash
+	virtual std::string Stamp(const std::string& path) = 0;
+};
+
+// hashes the file contents as read from the vfs
+// the file is read with ReadAllText, a copy, since a memory mapped file may change while
+// it is hashed
+struct ContentHashCheck : ChangeCheck
+{
+	explicit ContentHashCheck(VfsRead* v);
+	std::string Stamp(const std::string& path) override;
+
+	VfsRead* vfs;
+};
+
+// uses the modification time of the file on disk
+struct ModificationTimeCheck : ChangeCheck
+{
+	std::string Stamp(const std::string& path) override;
+};
+
+// Forwards to a vfs and stamps each file just before it is first read, so a file that
+// changes while a template is built from it is still seen as changed by the next check.
+struct StampingRead : VfsRead
+{
+	StampingRead(VfsRead* v, ChangeCheck* c);
+	std::string ReadAllText(const std::string& path) override;
+	bool Exists(const std::string& path) override;
+	std::string GetExtension(const std::string& file_path) override;
+	SourceText ReadSource(const std::string& path) override;
+
+	void StampOnce(const std::string& path);
+
+	VfsRead* vfs;
+	ChangeCheck* check;
+	std::vector<std::pair<std::string, std::string>> stamps;  // file and stamp, in read order
+};
+
+// Compiled templates keyed by path, built on first use and rebuilt by Reload when the
+// file or any of the files it includes has changed.
+// Get can be called from any number of threads, the lookup is a atomic load of a immutable
+// map so readers never wait on a lock. Building and reloading is serialized.
+template<typename T>
+class TemplateRegistry
+{
+   public:
+
+	struct Entry
+	{
+		Template<T> Compiled;
+		std::vector<Error> Errors;
+		std::vector<std::pair<std::string, std::string>> Stamps;  // file and stamp when read
+	};
+
+	TemplateRegistry(
+		VfsRead* v,
+		DirectoryInfo* i,
+		std::unordered_map<std::string, FuncGenerator> f,
+		Definition<T> d,
+		ChangeCheck* c
+	)
+		: vfs(v)
+		, includeDir(i)
+		, functions(std::move(f))
+		, definition(std::move(d))
+		, check(c)
+		, entries(std::make_shared<const Map>())
+	{
+	}
+
+	// the compiled template, the entry stays valid even if the template is reloaded
+	std::shared_ptr<const Entry> Get(const std::string& path)
+	{
+		if (auto found = Find(*entries.load(), path); found != nullptr)
+		{
+			return found;
+		}
+
+		std::scoped_lock lock{mutex};
+
+		// someone else might have built it while we waited
+		auto current = entries.load();
+		if (auto found = Find(*current, path); found != nullptr)
+		{
+			return found;
+		}
+
+		auto entry = BuildEntry(path);
+		auto updated = std::make_shared<Map>(*current);
+		updated->insert_or_assign(path, entry);
+		entries.store(std::move(updated));
+		return entry;
+	}
+
+	// rebuild all templates that have changed or failed to build, returns the rebuilt paths
+	std::vector<std::string> Reload()
+	{
+		std::scoped_lock lock{mutex};
+
+		auto current = entries.load();
+		auto updated = std::make_shared<Map>(*current);
+		std::vector<std::string> rebuilt;
+		for (const auto& [path, entry]: *current)
+		{
+			if (IsChanged(*entry))
+			{
+				updated->insert_or_assign(path, BuildEntry(path));
+				rebuilt.emplace_back(path);
+			}
+		}
+
+		if (rebuilt.empty() == false)
+		{
+			entries.store(std::move(updated));
+		}
+		return rebuilt;
+	}
+
+   private:
+
+	using Map = std::unordered_map<std::string, std::shared_ptr<const Entry>>;
+
+	static std::shared_ptr<const Entry> Find(const Map& map, const std::string& path)
+	{
+		const auto found = map.find(path);
+		return found == map.end() ? nullptr : found->second;
+	}
+
+	std::shared_ptr<const Entry> BuildEntry(const std::string& path)
+	{
+		// stamp before reading, a file changed during the build then differs on the next reload
+		StampingRead reader{vfs, check};
+		auto [compiled, errors] = BuildTemplate(path, &reader, includeDir, functions, definition);
+
+		return std::make_shared<const Entry>(
+			Entry{std::move(compiled), std::move(errors), std::move(reader.stamps)}
+		);
+	}
+
+	bool IsChanged(const Entry& entry)
+	{
+		// a failed build doesn't know all files, so always retry those
+		if (entry.Errors.empty() == false) return true;
+
+		for (const auto& [file, stamp]: entry.Stamps)
+		{
+			if (check->Stamp(file) != stamp) return true;
+		}
+		return false;
+	}
+
+	VfsRead* vfs;
+	DirectoryInfo* includeDir;
+	std::unordered_map<std::string, FuncGenerator> functions;
+	Definition<T> definition;
+	ChangeCheck* check;
+
+	std::mutex mutex;  // serializes building
+	std::atomic<std::shared_ptr<const Map>> entries;
+};
+}  //  namespace forma
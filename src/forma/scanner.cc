@@ -1,10 +1,22 @@
 #include "forma/scanner.hh"
 
+#include <bit>
+#include <cstdint>
 #include <optional>
 
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+	#include <immintrin.h>
+	#define FORMA_SCANNER_SIMD 1
+#endif
+
 namespace forma
 {
-Token::Token(TokenType t, std::string l, forma::Location lo, std::string v)
+TokenLocation::operator forma::Location() const
+{
+	return {std::string{File}, Line, Offset};
+}
+
+Token::Token(TokenType t, std::string_view l, TokenLocation lo, std::string_view v)
 	: Type(t)
 	, Lexeme(l)
 	, Location(lo)
@@ -17,7 +29,7 @@ Token Token::withType(TokenType new_type) const
 	return {new_type, Lexeme, Location, Value};
 }
 
-Token Token::withValue(const std::string& new_value) const
+Token Token::withValue(std::string_view new_value) const
 {
 	return {Type, Lexeme, Location, new_value};
 }
@@ -34,22 +46,109 @@ ScannerLocation with_index_offset(const ScannerLocation& l, int i, int o)
 	return {l.Line, o, i};
 }
 
+// result of skipping plain text
+struct TextSkip
+{
+	std::size_t End;  // index of the first {, or the size if there is none
+	int Newlines;  // number of newlines before End
+	std::size_t LastNewline;  // index of the last of those newlines
+};
+
+// finds the next { and counts the lines up to it, 16 or 32 chars at a time when possible
+TextSkip SkipText(std::string_view source, std::size_t start)
+{
+	auto skip = TextSkip{start, 0, 0};
+	const auto size = source.size();
+	const auto* data = source.data();
+
+	// adds the newlines in the mask, relative to the index
+	const auto count_newlines = [&skip](std::uint32_t newlines, std::size_t index)
+	{
+		if (newlines == 0) return;
+		skip.Newlines += std::popcount(newlines);
+		skip.LastNewline = index + static_cast<std::size_t>(std::bit_width(newlines)) - 1;
+	};
+
+	// handles a mask of { and newlines, returns true if a { was found
+	const auto found_brace = [&](std::uint32_t braces, std::uint32_t newlines, std::size_t index)
+	{
+		if (braces == 0)
+		{
+			count_newlines(newlines, index);
+			return false;
+		}
+		const auto first = std::countr_zero(braces);
+		count_newlines(newlines & ((std::uint32_t{1} << first) - 1), index);
+		skip.End = index + static_cast<std::size_t>(first);
+		return true;
+	};
+
+	auto index = start;
+
+#if defined(__AVX2__)
+	const auto brace32 = _mm256_set1_epi8('{');
+	const auto newline32 = _mm256_set1_epi8('\n');
+	for (; index + 32 <= size; index += 32)
+	{
+		const auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+		const auto braces
+			= static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, brace32)));
+		const auto newlines
+			= static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, newline32)));
+		if (found_brace(braces, newlines, index)) return skip;
+	}
+#endif
+
+#if defined(FORMA_SCANNER_SIMD)
+	const auto brace16 = _mm_set1_epi8('{');
+	const auto newline16 = _mm_set1_epi8('\n');
+	for (; index + 16 <= size; index += 16)
+	{
+		const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+		const auto braces
+			= static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, brace16)));
+		const auto newlines
+			= static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newline16)));
+		if (found_brace(braces, newlines, index)) return skip;
+	}
+#endif
+
+	for (; index < size; index += 1)
+	{
+		const auto c = data[index];
+		if (c == '{')
+		{
+			skip.End = index;
+			return skip;
+		}
+		if (c == '\n')
+		{
+			skip.Newlines += 1;
+			skip.LastNewline = index;
+		}
+	}
+
+	skip.End = size;
+	return skip;
+}
+
 struct Scanner
 {
-	std::string file;
-	std::string source;
+	std::string_view file;
+	std::string_view source;
 	ScannerLocation start;
 	ScannerLocation current;
 	bool insideCodeBlock;
 	std::vector<Error> errors;
-	std::vector<Token> ret;
+	std::pmr::vector<Token> ret;
 
-	Scanner(const std::string& f, const std::string& s)
+	Scanner(std::string_view f, std::string_view s, std::pmr::memory_resource* memory)
 		: file(f)
 		, source(s)
 		, start(ScannerLocation{1, 0, 0})
 		, current(start)
 		, insideCodeBlock(false)
+		, ret(memory)
 	{
 	}
 
@@ -58,20 +157,17 @@ struct Scanner
 		while (false == IsAtEnd())
 		{
 			start = current;
-			auto tokens = ScanToken();
-			for (const auto& tok: tokens)
-			{
-				ret.emplace_back(tok);
-			}
+			ScanToken();
 		}
-		ret.emplace_back(Token{TokenType::Eof, "", Location{file, current.Line, current.Offset}, ""}
+		ret.emplace_back(
+			Token{TokenType::Eof, "", TokenLocation{file, current.Line, current.Offset}, ""}
 		);
 
 		if (errors.empty() == false)
 		{
 			ret.clear();
 		}
-		return {ret, errors};
+		return {std::move(ret), std::move(errors)};
 	}
 
 	void ReportError(const Location& loc, const std::string& message)
@@ -79,17 +175,24 @@ struct Scanner
 		errors.push_back(Error{loc, message});
 	}
 
-	std::vector<Token> ScanToken()
+	// scan and add zero or more tokens
+	void ScanToken()
 	{
 		if (insideCodeBlock)
 		{
 			const auto tok = ScanCodeToken();
-			if (tok.has_value()) return {*tok};
+			if (tok.has_value()) ret.emplace_back(*tok);
 		}
 		else
 		{
 			while (insideCodeBlock == false && false == IsAtEnd())
 			{
+				SkipToBrace();
+				if (IsAtEnd())
+				{
+					break;
+				}
+
 				auto beforeStart = current;
 				auto c = Advance();
 				if (c == '{' && Match('{'))
@@ -103,7 +206,6 @@ struct Scanner
 					auto afterStart = current;
 					auto text = CreateToken(TokenType::Text, std::nullopt, start, beforeStart);
 
-					std::vector<Token> ret;
 					if (text.Value.length() > 0)
 					{
 						ret.emplace_back(text);
@@ -111,7 +213,7 @@ struct Scanner
 					insideCodeBlock = true;
 
 					ret.emplace_back(CreateToken(beginType, std::nullopt, beforeStart, current));
-					return ret;
+					return;
 				}
 			}
 
@@ -120,12 +222,10 @@ struct Scanner
 				auto text = CreateToken(TokenType::Text);
 				if (text.Value.length() > 0)
 				{
-					return {text};
+					ret.emplace_back(text);
 				}
 			}
 		}
-
-		return {};
 	}
 
 	std::optional<Token> ScanCodeToken()
@@ -265,6 +365,23 @@ struct Scanner
 		}
 	}
 
+	// move past the plain text before the next {, the same as calling Advance for each char
+	void SkipToBrace()
+	{
+		const auto index = static_cast<std::size_t>(current.Index);
+		const auto skip = SkipText(source, index);
+		if (skip.Newlines > 0)
+		{
+			current.Line += skip.Newlines;
+			current.Offset = static_cast<int>(skip.End - skip.LastNewline - 1);
+		}
+		else
+		{
+			current.Offset += static_cast<int>(skip.End - index);
+		}
+		current.Index = static_cast<int>(skip.End);
+	}
+
 	static bool IsDigit(char c)
 	{
 		return c >= '0' && c <= '9';
@@ -324,15 +441,15 @@ struct Scanner
 		return c;
 	}
 
-	Location GetStartLocation(std::optional<ScannerLocation> stt = std::nullopt)
+	TokenLocation GetStartLocation(std::optional<ScannerLocation> stt = std::nullopt)
 	{
 		const auto st = stt.value_or(start);
-		return Location(file, st.Line, st.Offset);
+		return TokenLocation{file, st.Line, st.Offset};
 	}
 
 	Token CreateToken(
 		TokenType tt,
-		std::optional<std::string> value = std::nullopt,
+		std::optional<std::string_view> value = std::nullopt,
 		std::optional<ScannerLocation> begin = std::nullopt,
 		std::optional<ScannerLocation> end = std::nullopt
 	)
@@ -349,11 +466,9 @@ struct Scanner
 	}
 };
 
-std::pair<std::vector<Token>, std::vector<Error>> Scan(
-	const std::string& file, const std::string& source
-)
+ScanResult Scan(std::string_view file, std::string_view source, std::pmr::memory_resource* memory)
 {
-	auto scanner = Scanner{file, source};
+	auto scanner = Scanner{file, source, memory};
 	return scanner.scan();
 }
 }  //  namespace forma
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "forma/core.hh"
@@ -64,16 +66,28 @@ S& operator<<(S& s, TokenType tt)
 	return s;
 }
 
+// where a token starts, the file is a view of the file name given to Scan
+// converts to a Location, that owns the file name, when a node or a error is created
+struct TokenLocation
+{
+	std::string_view File;
+	int Line;
+	int Offset;
+
+	operator forma::Location() const;
+};
+
+// the lexeme and value are views into the scanned source
 struct Token
 {
 	TokenType Type;
-	std::string Lexeme;
-	forma::Location Location;
-	std::string Value;
+	std::string_view Lexeme;
+	TokenLocation Location;
+	std::string_view Value;
 
-	Token(TokenType t, std::string l, forma::Location lo, std::string v);
+	Token(TokenType t, std::string_view l, TokenLocation lo, std::string_view v);
 	Token withType(TokenType t) const;
-	Token withValue(const std::string& v) const;
+	Token withValue(std::string_view v) const;
 };
 
 struct ScannerLocation
@@ -85,6 +99,12 @@ struct ScannerLocation
 	ScannerLocation(int l, int o, int i);
 };
 
-using ScanResult = std::pair<std::vector<Token>, std::vector<Error>>;
-ScanResult Scan(const std::string& file, const std::string& source);
+// the tokens refer to the source and the file name, so they need to outlive the tokens
+// the token list is allocated from the memory resource
+using ScanResult = std::pair<std::pmr::vector<Token>, std::vector<Error>>;
+ScanResult Scan(
+	std::string_view file,
+	std::string_view source,
+	std::pmr::memory_resource* memory = std::pmr::get_default_resource()
+);
 };	//  namespace forma
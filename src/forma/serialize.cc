@@ -0,0 +1,396 @@
+#include "forma/serialize.hh"
+
+#include <algorithm>
+#include <vector>
+
+namespace forma
+{
+constexpr std::string_view AstMagic = "forma-ast";
+
+std::uint64_t HashSource(std::string_view source)
+{
+	// 64 bit fnv-1a, std::hash isn't guaranteed to be the same between runs
+	std::uint64_t hash = 14695981039346656037ull;
+	for (const char c: source)
+	{
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+std::uint64_t HashFile(VfsRead* vfs, const std::string& path)
+{
+	if (vfs->Exists(path) == false) return 0;
+	return HashSource(vfs->ReadSource(path).Text);
+}
+
+// little endian, independent of the platform
+struct AstWriter
+{
+	std::string data;
+
+	void U8(std::uint8_t v)
+	{
+		data.push_back(static_cast<char>(v));
+	}
+
+	void U32(std::uint32_t v)
+	{
+		for (int i = 0; i < 4; i += 1)
+		{
+			U8(static_cast<std::uint8_t>(v >> (i * 8)));
+		}
+	}
+
+	void I32(int v)
+	{
+		U32(static_cast<std::uint32_t>(v));
+	}
+
+	void U64(std::uint64_t v)
+	{
+		U32(static_cast<std::uint32_t>(v));
+		U32(static_cast<std::uint32_t>(v >> 32));
+	}
+
+	void String(std::string_view s)
+	{
+		U32(static_cast<std::uint32_t>(s.size()));
+		data.append(s);
+	}
+};
+
+// reading past the end or a bad value sets ok to false, the rest of the reads return zero
+struct AstReader
+{
+	std::string_view data;
+	std::size_t position = 0;
+	bool ok = true;
+
+	std::uint8_t U8()
+	{
+		if (position >= data.size())
+		{
+			ok = false;
+			return 0;
+		}
+		const auto v = static_cast<std::uint8_t>(data[position]);
+		position += 1;
+		return v;
+	}
+
+	std::uint32_t U32()
+	{
+		std::uint32_t v = 0;
+		for (int i = 0; i < 4; i += 1)
+		{
+			v |= static_cast<std::uint32_t>(U8()) << (i * 8);
+		}
+		return v;
+	}
+
+	int I32()
+	{
+		return static_cast<int>(U32());
+	}
+
+	std::uint64_t U64()
+	{
+		const std::uint64_t low = U32();
+		const std::uint64_t high = U32();
+		return low | (high << 32);
+	}
+
+	std::string_view String()
+	{
+		const auto size = U32();
+		if (ok == false || data.size() - position < size)
+		{
+			ok = false;
+			return {};
+		}
+		const auto s = data.substr(position, size);
+		position += size;
+		return s;
+	}
+
+	// a count of items, each at least min_size bytes, so a damaged count can't allocate much
+	std::uint32_t Count(std::size_t min_size)
+	{
+		const auto count = U32();
+		if (ok == false || (data.size() - position) / min_size < count)
+		{
+			ok = false;
+			return 0;
+		}
+		return count;
+	}
+};
+
+std::string SaveAst(const Ast& ast, VfsRead* vfs)
+{
+	AstWriter w;
+	w.data.append(AstMagic);
+	w.U32(AstFormatVersion);
+
+	const auto files = ast.Files();
+	w.U32(static_cast<std::uint32_t>(files.size()));
+	for (const auto& file: files)
+	{
+		w.String(file);
+		w.U64(HashFile(vfs, file));
+	}
+
+	const auto location = [&](const Location& l)
+	{
+		const auto found = std::find(files.begin(), files.end(), l.File);
+		w.U32(static_cast<std::uint32_t>(found - files.begin()));
+		w.I32(l.Line);
+		w.I32(l.Offset);
+	};
+
+	w.U32(static_cast<std::uint32_t>(ast.Nodes.size()));
+	for (const auto& n: ast.Nodes)
+	{
+		w.U8(static_cast<std::uint8_t>(n.index()));
+		if (const auto* text = std::get_if<node::Text>(&n))
+		{
+			w.String(text->Value);
+			location(text->Location);
+		}
+		else if (const auto* attribute = std::get_if<node::Attribute>(&n))
+		{
+			w.String(attribute->Name);
+			location(attribute->Location);
+		}
+		else if (const auto* iterate = std::get_if<node::Iterate>(&n))
+		{
+			w.String(iterate->Name);
+			w.U32(iterate->Body);
+			location(iterate->Location);
+		}
+		else if (const auto* check = std::get_if<node::If>(&n))
+		{
+			w.String(check->Name);
+			w.U32(check->Body);
+			location(check->Location);
+		}
+		else if (const auto* fc = std::get_if<node::FunctionCall>(&n))
+		{
+			w.String(fc->Name);
+			w.U32(static_cast<std::uint32_t>(fc->Arguments.size()));
+			for (const auto& arg: fc->Arguments)
+			{
+				w.String(arg.Argument);
+				location(arg.Location);
+			}
+			w.U32(fc->Arg);
+			location(fc->Location);
+		}
+		else if (const auto* gr = std::get_if<node::Group>(&n))
+		{
+			w.U32(gr->First);
+			w.U32(gr->Count);
+			location(gr->Location);
+		}
+	}
+
+	w.U32(static_cast<std::uint32_t>(ast.Members.size()));
+	for (const auto m: ast.Members)
+	{
+		w.U32(m);
+	}
+
+	w.U32(ast.Root);
+	return std::move(w.data);
+}
+
+std::optional<Ast> LoadAst(
+	std::string_view blob,
+	VfsRead* vfs,
+	const std::unordered_map<std::string, FuncGenerator>& functions
+)
+{
+	if (blob.substr(0, AstMagic.size()) != AstMagic)
+	{
+		return std::nullopt;
+	}
+
+	AstReader r{blob, AstMagic.size()};
+	if (r.U32() != AstFormatVersion)
+	{
+		return std::nullopt;
+	}
+
+	std::vector<std::string> files;
+	const auto file_count = r.Count(12);
+	for (std::uint32_t i = 0; i < file_count; i += 1)
+	{
+		const auto file = std::string{r.String()};
+		const auto hash = r.U64();
+		if (r.ok == false || HashFile(vfs, file) != hash)
+		{
+			return std::nullopt;
+		}
+		files.emplace_back(file);
+	}
+
+	const auto location = [&]() -> Location
+	{
+		const auto file = r.U32();
+		const auto line = r.I32();
+		const auto offset = r.I32();
+		if (file >= files.size())
+		{
+			r.ok = false;
+			return UnknownLocation();
+		}
+		return {files[file], line, offset};
+	};
+
+	Ast ast;
+	const auto node_count = r.Count(1);
+	ast.Nodes.reserve(node_count);
+	for (std::uint32_t i = 0; i < node_count && r.ok; i += 1)
+	{
+		switch (r.U8())
+		{
+		case 0:
+			{
+				auto value = std::string{r.String()};
+				ast.Add(node::Text{std::move(value), location()});
+			}
+			break;
+		case 1:
+			{
+				auto name = std::string{r.String()};
+				ast.Add(node::Attribute{std::move(name), location()});
+			}
+			break;
+		case 2:
+			{
+				auto name = std::string{r.String()};
+				const auto body = r.U32();
+				ast.Add(node::Iterate{std::move(name), body, location()});
+			}
+			break;
+		case 3:
+			{
+				auto name = std::string{r.String()};
+				const auto body = r.U32();
+				ast.Add(node::If{std::move(name), body, location()});
+			}
+			break;
+		case 4:
+			{
+				auto name = std::string{r.String()};
+				std::vector<FuncArgument> arguments;
+				const auto argument_count = r.Count(16);
+				for (std::uint32_t a = 0; a < argument_count; a += 1)
+				{
+					auto argument = std::string{r.String()};
+					arguments.emplace_back(FuncArgument{location(), std::move(argument)});
+				}
+				const auto arg = r.U32();
+				const auto call_location = location();
+
+				// functions can't be saved, so create them again from the arguments
+				const auto generator = functions.find(name);
+				if (generator == functions.end())
+				{
+					return std::nullopt;
+				}
+				auto [func, errors] = generator->second(call_location, arguments);
+				if (errors.empty() == false)
+				{
+					return std::nullopt;
+				}
+				ast.Add(node::FunctionCall{
+					std::move(name), std::move(arguments), std::move(func), arg, call_location
+				});
+			}
+			break;
+		case 5:
+			{
+				const auto first = r.U32();
+				const auto count = r.U32();
+				ast.Add(node::Group{first, count, location()});
+			}
+			break;
+		default: return std::nullopt;
+		}
+	}
+
+	const auto member_count = r.Count(4);
+	ast.Members.reserve(member_count);
+	for (std::uint32_t i = 0; i < member_count; i += 1)
+	{
+		ast.Members.emplace_back(r.U32());
+	}
+	ast.Root = r.U32();
+
+	if (r.ok == false || r.position != blob.size())
+	{
+		return std::nullopt;
+	}
+
+	// make sure all references are valid so the ast can be used without any checks
+	// the parser always adds the children before the parent, which also rules out cycles
+	if (ast.Root >= ast.Nodes.size())
+	{
+		return std::nullopt;
+	}
+	for (NodeIndex i = 0; i < ast.Nodes.size(); i += 1)
+	{
+		const auto before = [i](NodeIndex child) { return child < i; };
+		const auto& n = ast.Nodes[i];
+		auto valid = true;
+		if (const auto* iterate = std::get_if<node::Iterate>(&n))
+		{
+			valid = before(iterate->Body);
+		}
+		else if (const auto* check = std::get_if<node::If>(&n))
+		{
+			valid = before(check->Body);
+		}
+		else if (const auto* fc = std::get_if<node::FunctionCall>(&n))
+		{
+			valid = before(fc->Arg);
+		}
+		else if (const auto* gr = std::get_if<node::Group>(&n))
+		{
+			valid = gr->First <= ast.Members.size() && gr->Count <= ast.Members.size() - gr->First
+				 && std::all_of(ast.MembersOf(*gr).begin(), ast.MembersOf(*gr).end(), before);
+		}
+
+		if (valid == false)
+		{
+			return std::nullopt;
+		}
+	}
+
+	return ast;
+}
+
+ParseResult LoadOrParseFile(
+	std::string* blob,
+	const std::string& path,
+	VfsRead* vfs,
+	DirectoryInfo* includeDir,
+	const std::unordered_map<std::string, FuncGenerator>& functions
+)
+{
+	if (auto loaded = LoadAst(*blob, vfs, functions); loaded.has_value())
+	{
+		return {std::move(*loaded), NoErrors()};
+	}
+
+	auto [ast, errors] = ParseFile(path, vfs, includeDir, functions);
+	if (errors.empty())
+	{
+		*blob = SaveAst(ast, vfs);
+	}
+	return {std::move(ast), std::move(errors)};
+}
+}  //  namespace forma
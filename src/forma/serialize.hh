@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "forma/core.hh"
+#include "forma/parser.hh"
+
+namespace forma
+{
+// bumped whenever the binary layout changes, blobs with other versions are rejected
+constexpr std::uint32_t AstFormatVersion = 1;
+
+// a stable hash of the source, saved with the ast to detect changed files
+std::uint64_t HashSource(std::string_view source);
+
+// Serialize a parsed ast to a compact binary blob.
+// The blob contains the hash of every file the ast was parsed from, read through the vfs.
+std::string SaveAst(const Ast& ast, VfsRead* vfs);
+
+// Load a ast saved by SaveAst.
+// Returns nothing if the blob is from a different version, is damaged, if any of the source
+// files have changed or if a function can no longer be created with the saved arguments.
+std::optional<Ast> LoadAst(
+	std::string_view blob,
+	VfsRead* vfs,
+	const std::unordered_map<std::string, FuncGenerator>& functions
+);
+
+// Load the ast from the blob or parse the file if the blob is out of date.
+// The blob is updated after a successful parse so the caller can store it for the next time.
+ParseResult LoadOrParseFile(
+	std::string* blob,
+	const std::string& path,
+	VfsRead* vfs,
+	DirectoryInfo* includeDir,
+	const std::unordered_map<std::string, FuncGenerator>& functions
+);
+}  //  namespace forma
@@ -0,0 +1,415 @@
+// forma benchmarks
+// Measures scan, parse, validate and render separately for a few generated templates and
+// prints the results as json, run with --help for the options.
+
+#include "forma/template.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <iostream>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ====================================================================================================================
+// allocation counting
+
+namespace
+{
+std::atomic<std::uint64_t> allocations = 0;
+}
+
+// the replaced new and delete are a matching pair even if gcc can't tell once they are inlined
+#if defined(__GNUC__) && ! defined(__clang__)
+	#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto* p = std::malloc(size == 0 ? 1 : size))
+	{
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+// the default memory resource allocates with the aligned versions
+// malloc has no aligned counterpart everywhere, so align by hand and keep the malloc pointer
+// just before the returned memory
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	const auto align = static_cast<std::size_t>(alignment);
+	auto* raw = std::malloc(size + align + sizeof(void*));
+	if (raw == nullptr)
+	{
+		throw std::bad_alloc{};
+	}
+	const auto address
+		= (reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*) + align - 1) & ~(align - 1);
+	reinterpret_cast<void**>(address)[-1] = raw;
+	return reinterpret_cast<void*>(address);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+	if (p != nullptr)
+	{
+		std::free(static_cast<void**>(p)[-1]);
+	}
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+namespace
+{
+// ====================================================================================================================
+// data
+
+struct Item
+{
+	std::string Name;
+	std::string Description;
+	int Count;
+	bool Featured;
+	std::vector<Item> Children;
+};
+
+forma::Definition<Item> MakeItemDef(int depth)
+{
+	auto def = forma::Definition<Item>()
+				   .AddMember<&Item::Name>("name")
+				   .AddMember<&Item::Description>("description")
+				   .AddMember<&Item::Count>("count")
+				   .AddMember<&Item::Featured>("featured");
+	if (depth > 0)
+	{
+		def.AddList<Item>(
+			"children",
+			[](const Item& item) -> const std::vector<Item>& { return item.Children; },
+			MakeItemDef(depth - 1)
+		);
+	}
+	return def;
+}
+
+Item MakeItem(int depth, int width, int* counter)
+{
+	*counter += 1;
+	auto item = Item{
+		"item number " + std::to_string(*counter),
+		"  a somewhat longer description of the item, with Mixed case  ",
+		*counter,
+		*counter % 3 == 0,
+		{}
+	};
+	if (depth > 0)
+	{
+		for (int i = 0; i < width; i += 1)
+		{
+			item.Children.emplace_back(MakeItem(depth - 1, width, counter));
+		}
+	}
+	return item;
+}
+
+// ====================================================================================================================
+// templates
+
+struct Scenario
+{
+	std::string Name;
+	std::string Source;
+	int Depth;  // the depth of the data and the definition
+	int Width;  // the number of children of each item
+	std::string Expected = {};  // a part of the output, so the measured filters do something
+};
+
+std::string Repeat(const std::string& s, int count)
+{
+	std::string r;
+	for (int i = 0; i < count; i += 1)
+	{
+		r += s;
+	}
+	return r;
+}
+
+// a range for each level, the innermost body is the argument
+std::string Nested(int depth, const std::string& body)
+{
+	if (depth == 0) return body;
+	return "<ul>{{range children}}<li>{{name}}" + Nested(depth - 1, body) + "</li>{{end}}</ul>";
+}
+
+std::vector<Scenario> MakeScenarios()
+{
+	const auto paragraph
+		= std::string{"<p class=\"text\">Lorem ipsum dolor sit amet, consectetur adipiscing elit, "}
+		+ "sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim "
+		+ "veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo.</p>\n";
+
+	return {
+		{"small",
+		 "<h1>{{name}}</h1>\n<p>{{description | trim}}</p>{{if featured}}!{{end}}\n",
+		 0,
+		 0},
+		{"html_1mb",
+		 Repeat(Repeat(paragraph, 20) + "<div>{{name}} {{count}}</div>\n", 200),
+		 0,
+		 0},
+		{"nested_ranges", Nested(4, "<span>{{count | zfill(6)}}</span>"), 4, 8},
+		{"filter_chains",
+		 "{{range children}}"
+			 + Repeat(
+				 "<td>{{description | trim | lower | title | replace(Item, Thing) | upper}}</td>"
+				 "<td>{{name | capitalize | replace_many(Item, x, Number, n) | zfill(30)}}</td>\n",
+				 4
+			 )
+			 + "{{end}}",
+		 1,
+		 200,
+		 "<td>A SOMEWHAT LONGER DESCRIPTION OF THE THING, WITH MIXED CASE</td>"
+		 "<td>0000000000000000000000000x n 2</td>"}
+	};
+}
+
+// ====================================================================================================================
+// measuring
+
+struct VfsBench : forma::VfsRead
+{
+	std::unordered_map<std::string, std::string> files;
+
+	std::string ReadAllText(const std::string& path) override
+	{
+		return files[path];
+	}
+
+	bool Exists(const std::string& path) override
+	{
+		return files.find(path) != files.end();
+	}
+
+	std::string GetExtension(const std::string& file_path) override
+	{
+		const auto pos = file_path.find_last_of('.');
+		return pos == std::string::npos ? "" : file_path.substr(pos);
+	}
+};
+
+struct DirectoryBench : forma::DirectoryInfo
+{
+	std::string GetFile(const std::string& nameAndExtension) override
+	{
+		return nameAndExtension;
+	}
+};
+
+struct Timing
+{
+	double Nanoseconds;  // per run
+	double Allocations;  // per run
+	std::uint64_t Runs;
+};
+
+// call f until the minimum time has passed
+template<typename F>
+Timing Measure(std::chrono::milliseconds minimum, F&& f)
+{
+	using Clock = std::chrono::steady_clock;
+
+	f();  // warm up
+
+	const auto allocations_before = allocations.load();
+	const auto start = Clock::now();
+	auto end = start;
+	std::uint64_t runs = 0;
+	while (end - start < minimum)
+	{
+		f();
+		runs += 1;
+		end = Clock::now();
+	}
+	const auto allocated = allocations.load() - allocations_before;
+
+	const auto elapsed = std::chrono::duration<double, std::nano>(end - start).count();
+	return {elapsed / static_cast<double>(runs),
+			static_cast<double>(allocated) / static_cast<double>(runs),
+			runs};
+}
+
+void PrintTiming(const char* name, const Timing& timing)
+{
+	std::printf(
+		"      \"%s\": {\"ns\": %.0f, \"allocations\": %.1f, \"runs\": %llu},\n",
+		name,
+		timing.Nanoseconds,
+		timing.Allocations,
+		static_cast<unsigned long long>(timing.Runs)
+	);
+}
+
+void RunScenario(const Scenario& scenario, std::chrono::milliseconds minimum, bool last)
+{
+	const auto file = scenario.Name + ".html";
+	VfsBench vfs;
+	vfs.files[file] = scenario.Source;
+	DirectoryBench dir;
+	const auto functions = forma::DefaultFunctions();
+	const auto definition = MakeItemDef(scenario.Depth);
+
+	int counter = 0;
+	const auto item = MakeItem(scenario.Depth, scenario.Width, &counter);
+
+	auto [tokens, scan_errors] = forma::Scan(file, scenario.Source);
+	auto [ast, parse_errors] = forma::Parse(tokens, functions, &dir, ".html", &vfs);
+	auto [compiled, validate_errors] = definition.Validate(ast);
+	if (scan_errors.empty() == false || parse_errors.empty() == false
+		|| validate_errors.empty() == false)
+	{
+		std::cerr << scenario.Name << " failed to build\n";
+		std::exit(1);
+	}
+	if (compiled.Render(item).find(scenario.Expected) == std::string::npos)
+	{
+		std::cerr << scenario.Name << " doesn't render " << scenario.Expected << "\n";
+		std::exit(1);
+	}
+
+	const auto scan = Measure(minimum, [&] { return forma::Scan(file, scenario.Source); });
+	const auto parse
+		= Measure(minimum, [&] { return forma::Parse(tokens, functions, &dir, ".html", &vfs); });
+	const auto validate = Measure(minimum, [&] { return definition.Validate(ast); });
+
+	std::string output;
+	const auto render = Measure(
+		minimum,
+		[&]
+		{
+			output.clear();
+			compiled.Render(item, &output);
+		}
+	);
+
+	// everything the render allocates comes from a buffer that is released at once
+	std::vector<std::byte> arena(output.size() * 2 + 65536);
+	const auto render_arena = Measure(
+		minimum,
+		[&]
+		{
+			std::pmr::monotonic_buffer_resource memory{arena.data(), arena.size()};
+			const auto rendered = compiled.Render(item, &memory);
+		}
+	);
+
+	const auto seconds = render.Nanoseconds / 1e9;
+	std::printf("    {\n");
+	std::printf("      \"name\": \"%s\",\n", scenario.Name.c_str());
+	std::printf("      \"source_bytes\": %zu,\n", scenario.Source.size());
+	std::printf("      \"output_bytes\": %zu,\n", output.size());
+	std::printf("      \"items\": %d,\n", counter);
+	PrintTiming("scan", scan);
+	PrintTiming("parse", parse);
+	PrintTiming("validate", validate);
+	PrintTiming("render", render);
+	PrintTiming("render_arena", render_arena);
+	const auto megabytes = static_cast<double>(output.size()) / 1e6;
+	std::printf("      \"render_mb_per_s\": %.1f,\n", megabytes / seconds);
+	std::printf("      \"renders_per_s\": %.1f\n", 1.0 / seconds);
+	std::printf("    }%s\n", last ? "" : ",");
+}
+}  //  namespace
+
+int main(int argc, char** argv)
+{
+	auto minimum = std::chrono::milliseconds{200};
+	std::string filter;
+	for (int i = 1; i < argc; i += 1)
+	{
+		const auto arg = std::string{argv[i]};
+		if (arg == "--min-time-ms" && i + 1 < argc)
+		{
+			i += 1;
+			minimum = std::chrono::milliseconds{std::atoi(argv[i])};
+		}
+		else if (arg == "--filter" && i + 1 < argc)
+		{
+			i += 1;
+			filter = argv[i];
+		}
+		else
+		{
+			std::cerr << "usage: forma_bench [--min-time-ms 200] [--filter name]\n";
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+	std::vector<Scenario> scenarios;
+	for (auto& scenario: MakeScenarios())
+	{
+		if (filter.empty() || scenario.Name.find(filter) != std::string::npos)
+		{
+			scenarios.emplace_back(std::move(scenario));
+		}
+	}
+
+	std::printf("{\n  \"min_time_ms\": %lld,\n", static_cast<long long>(minimum.count()));
+	std::printf("  \"benchmarks\": [\n");
+	for (std::size_t index = 0; index < scenarios.size(); index += 1)
+	{
+		RunScenario(scenarios[index], minimum, index + 1 == scenarios.size());
+	}
+	std::printf("  ]\n}\n");
+	return 0;
+}
@@ -1,17 +1,30 @@
 ﻿#include "template.hh"
 
+#include <algorithm>
 #include <optional>
 #include <string>
 #include <functional>
+#include <memory>
 
 namespace forma
 {
 FuncGeneratorResult SyntaxError(const std::vector<Error>& errors)
 {
-	return {[](const std::string&) { return "syntax error"; }, errors};
+	return {[](const Value&, Sink& output) { output.Write("syntax error"); }, errors};
 }
 
-FuncGenerator NoArguments(std::function<std::string(const std::string&)> f)
+// call f with the text of the argument, numbers are formatted on the stack
+template<typename F>
+Func TextFunc(F f)
+{
+	return [f](const Value& arg, Sink& output)
+	{
+		NumberBuffer buffer;
+		f(ToText(arg, &buffer), output);
+	};
+}
+
+FuncGenerator NoArguments(std::function<void(std::string_view, Sink&)> f)
 {
 	return [f](const Location& location, const std::vector<FuncArgument>& args)
 	{
@@ -19,7 +32,7 @@ FuncGenerator NoArguments(std::function<std::string(const std::string&)> f)
 		{
 			return SyntaxError({Error(location, "Expected zero arguments")});
 		}
-		return FuncGeneratorResult{[f](const std::string& arg) { return f(arg); }, NoErrors()};
+		return FuncGeneratorResult{TextFunc(f), NoErrors()};
 	};
 }
 
@@ -40,7 +53,7 @@ std::optional<int> parse_int(const std::string& s)
 }
 
 FuncGenerator OptionalStringArgument(
-	std::function<std::string(const std::string&, const std::string&)> f, std::string missing
+	std::function<void(std::string_view, std::string_view, Sink&)> f, std::string missing
 )
 {
 	return [f, missing](const Location& location, const std::vector<FuncArgument>& args)
@@ -48,14 +61,18 @@ FuncGenerator OptionalStringArgument(
 		if (args.size() == 0)
 		{
 			return FuncGeneratorResult(
-				[f, missing](const std::string& arg) { return f(arg, missing); }, NoErrors()
+				TextFunc([f, missing](std::string_view arg, Sink& output)
+						 { f(arg, missing, output); }),
+				NoErrors()
 			);
 		}
 		else if (args.size() == 1)
 		{
 			const auto first_arg = args[0].Argument;
 			return FuncGeneratorResult(
-				[f, first_arg](const std::string& arg) { return f(arg, first_arg); }, NoErrors()
+				TextFunc([f, first_arg](std::string_view arg, Sink& output)
+						 { f(arg, first_arg, output); }),
+				NoErrors()
 			);
 		}
 		else
@@ -65,14 +82,15 @@ FuncGenerator OptionalStringArgument(
 	};
 }
 
-FuncGenerator OptionalIntArgument(std::function<std::string(std::string, int)> f, int missing)
+FuncGenerator OptionalIntArgument(std::function<void(const Value&, int, Sink&)> f, int missing)
 {
 	return [f, missing](const Location& location, const std::vector<FuncArgument>& args)
 	{
 		if (args.size() == 0)
 		{
 			return FuncGeneratorResult(
-				[f, missing](const std::string& arg) { return f(arg, missing); }, NoErrors()
+				[f, missing](const Value& arg, Sink& output) { f(arg, missing, output); },
+				NoErrors()
 			);
 		}
 		else if (args.size() == 1)
@@ -82,7 +100,7 @@ FuncGenerator OptionalIntArgument(std::function<std::string(std::string, int)> f
 			{
 				const auto the_number = *number;
 				return FuncGeneratorResult(
-					[f, the_number](const std::string& arg) { return f(arg, the_number); },
+					[f, the_number](const Value& arg, Sink& output) { f(arg, the_number, output); },
 					NoErrors()
 				);
 			}
@@ -102,7 +120,7 @@ FuncGenerator OptionalIntArgument(std::function<std::string(std::string, int)> f
 }
 
 FuncGenerator StringStringArgument(
-	std::function<std::string(std::string, std::string, std::string)> f
+	std::function<void(std::string_view, std::string_view, std::string_view, Sink&)> f
 )
 {
 	return [f](const Location& location, const std::vector<FuncArgument>& args)
@@ -112,14 +130,14 @@ FuncGenerator StringStringArgument(
 			return SyntaxError({Error(location, "Expected two arguments")});
 		}
 		return FuncGeneratorResult{
-			[f, args](const std::string& arg) -> std::string
-			{ return f(arg, args[0].Argument, args[1].Argument); },
+			TextFunc([f, args](std::string_view arg, Sink& output)
+					 { f(arg, args[0].Argument, args[1].Argument, output); }),
 			NoErrors()
 		};
 	};
 }
 
-FuncGenerator IntIntArgument(std::function<std::string(std::string, int, int)> f)
+FuncGenerator IntIntArgument(std::function<void(std::string_view, int, int, Sink&)> f)
 {
 	return [f](const Location& location, const std::vector<FuncArgument>& args)
 	{
@@ -141,12 +159,56 @@ FuncGenerator IntIntArgument(std::function<std::string(std::string, int, int)> f
 		}
 
 		return FuncGeneratorResult{
-			[f, lhs, rhs](const std::string& arg) -> std::string { return f(arg, *lhs, *rhs); },
+			TextFunc([f, lhs, rhs](std::string_view arg, Sink& output)
+					 { f(arg, *lhs, *rhs, output); }),
 			NoErrors()
 		};
 	};
 }
 
+// pad the text of the value with zeros, numbers are formatted on the stack
+void ZeroFill(const Value& value, int count, Sink& output)
+{
+	constexpr std::string_view zeros = "00000000000000000000000000000000";
+
+	NumberBuffer buffer;
+	const auto text = ToText(value, &buffer);
+	auto missing = count > 0 ? static_cast<std::size_t>(count) : 0;
+	missing = missing > text.size() ? missing - text.size() : 0;
+	while (missing > 0)
+	{
+		const auto size = std::min(missing, zeros.size());
+		output.Write(zeros.substr(0, size));
+		missing -= size;
+	}
+	output.Write(text);
+}
+
+// replace_many(a, b, c, d) replaces a with b and c with d in a single pass
+FuncGeneratorResult ReplaceMany(const Location& location, const std::vector<FuncArgument>& args)
+{
+	if (args.empty() || args.size() % 2 != 0)
+	{
+		return SyntaxError({Error(location, "Expected pairs of patterns and replacements")});
+	}
+
+	std::vector<std::pair<std::string, std::string>> replacements;
+	for (std::size_t index = 0; index < args.size(); index += 2)
+	{
+		if (args[index].Argument.empty())
+		{
+			return SyntaxError({Error(args[index].Location, "The pattern can't be empty")});
+		}
+		replacements.emplace_back(args[index].Argument, args[index + 1].Argument);
+	}
+
+	const auto replacer = std::make_shared<const strings::MultiReplace>(std::move(replacements));
+	return {
+		TextFunc([replacer](std::string_view arg, Sink& output) { replacer->Write(arg, output); }),
+		NoErrors()
+	};
+}
+
 std::unordered_map<std::string, FuncGenerator> DefaultFunctions()
 {
 	// auto culture = CultureInfo("en-US", false);
@@ -154,58 +216,50 @@ std::unordered_map<std::string, FuncGenerator> DefaultFunctions()
 	auto t = std::unordered_map<std::string, FuncGenerator>();
 	t.insert(
 		{"capitalize",
-		 NoArguments([](const std::string& args) { return strings::Capitalize(args, true); })}
-	);
-	t.insert({"lower", NoArguments([](const std::string& args) { return strings::ToLower(args); })}
-	);
-	t.insert({"upper", NoArguments([](const std::string& args) { return strings::ToUpper(args); })}
+		 NoArguments([](std::string_view arg, Sink& output)
+					 { strings::WriteCapitalized(arg, true, output); })}
 	);
+	t.insert({"lower", NoArguments(strings::WriteLower)});
+	t.insert({"upper", NoArguments(strings::WriteUpper)});
 	t.insert(
-		{"title", NoArguments([](const std::string& args) { return strings::ToTitleCase(args); })}
+		{"title",
+		 NoArguments([](std::string_view arg, Sink& output)
+					 { strings::WriteCapitalized(arg, true, output); })}
 	);
 
+	// trimming only writes a smaller view of the argument
 	t.insert(
 		{"rtrim",
 		 OptionalStringArgument(
-			 [](const std::string& str, const std::string& spaceChars)
-			 { return strings::TrimEnd(str, spaceChars); },
+			 [](std::string_view str, std::string_view spaceChars, Sink& output)
+			 { output.Write(strings::TrimEndView(str, spaceChars)); },
 			 strings::default_space()
 		 )}
 	);
 	t.insert(
 		{"ltrim",
 		 OptionalStringArgument(
-			 [](const std::string& str, const std::string& spaceChars)
-			 { return strings::TrimStart(str, spaceChars); },
+			 [](std::string_view str, std::string_view spaceChars, Sink& output)
+			 { output.Write(strings::TrimStartView(str, spaceChars)); },
 			 strings::default_space()
 		 )}
 	);
 	t.insert(
 		{"trim",
 		 OptionalStringArgument(
-			 [](const std::string& str, const std::string& spaceChars)
-			 { return strings::Trim(str, spaceChars); },
+			 [](std::string_view str, std::string_view spaceChars, Sink& output)
+			 { output.Write(strings::TrimView(str, spaceChars)); },
 			 strings::default_space()
 		 )}
 	);
-	t.insert(
-		{"zfill",
-		 OptionalIntArgument(
-			 [](const std::string& str, int count) { return strings::PadLeft(str, count, '0'); }, 3
-		 )}
-	);
+	t.insert({"zfill", OptionalIntArgument(ZeroFill, 3)});
 
-	t.insert(
-		{"replace",
-		 StringStringArgument(
-			 [](const std::string& arg, const std::string& lhs, const std::string& rhs)
-			 { return strings::Replace(arg, lhs, rhs); }
-		 )}
-	);
+	t.insert({"replace", StringStringArgument(strings::WriteReplaced)});
+	t.insert({"replace_many", ReplaceMany});
 	t.insert(
 		{"substr",
-		 IntIntArgument([](const std::string& arg, int lhs, int rhs)
-						{ return strings::Substring(arg, lhs, rhs); })}
+		 IntIntArgument([](std::string_view arg, int lhs, int rhs, Sink& output)
+						{ output.Write(strings::SubstringView(arg, lhs, rhs)); })}
 	);
 	return t;
 }
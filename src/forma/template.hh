@@ -8,16 +8,26 @@
 // ReSharper disable CppNonInlineFunctionDefinitionInHeaderFile
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <memory_resource>
 #include <unordered_map>
 #include <cassert>
-#include <sstream>
+#include <charconv>
+#include <ranges>
+#include <type_traits>
 
 #include "forma/core.hh"
+#include "forma/memory.hh"
 #include "forma/scanner.hh"
 #include "forma/parser.hh"
+#include "forma/program.hh"
+#include "forma/thread_pool.hh"
 
 /*
 
@@ -25,6 +35,13 @@
     auto (generator, error) = Template.Parse(...);
     string ret = generator(myClass);
 
+    // or stream into a sink/reused buffer
+    auto (compiled, error) = Template.BuildTemplate(...);
+    compiled.Render(myClass, &buffer);
+
+    // or allocate everything from a memory resource, like a monotonic buffer per request
+    std::pmr::string out = compiled.Render(myClass, &arena);
+
   Template syntax:
     {{ prop }} {{- "also prop, trim printable spaces" -}}
     {{prop | function | function(with_arguments)}}
@@ -41,25 +58,208 @@
 
 namespace forma
 {
+// A guess of the output size, so a render can reserve the output once.
+// Starts at the size of the static text and follows a running average of the rendered sizes.
+class SizeEstimate
+{
+   public:
+
+	explicit SizeEstimate(std::size_t staticSize)
+		: static_size(staticSize)
+	{
+	}
+
+	std::size_t Guess() const
+	{
+		return std::max(static_size, average.load(std::memory_order_relaxed));
+	}
+
+	// concurrent renders may lose an update, that is fine for an estimate
+	void Add(std::size_t size)
+	{
+		const auto old = average.load(std::memory_order_relaxed);
+		const auto updated = old == 0 ? size : old - old / 8 + size / 8;
+		average.store(updated, std::memory_order_relaxed);
+	}
+
+   private:
+
+	std::size_t static_size;
+	std::atomic<std::size_t> average = 0;
+};
+
+// a validated template, ready to be rendered
+// rendering keeps all state local so a template can be shared and rendered from many threads
+template<typename T>
+class Template
+{
+   public:
+
+	explicit Template(forma::Program<T> p, std::vector<std::string> f = {})
+		: program(std::make_shared<const forma::Program<T>>(std::move(p)))
+		, files(std::move(f))
+		, estimate(std::make_shared<SizeEstimate>(StaticSize(*program)))
+	{
+	}
+
+	// write the output to the sink, the main render entry point
+	void Render(const T& t, Sink& sink) const
+	{
+		Render(t, sink, std::pmr::get_default_resource());
+	}
+
+	// append the output to a caller owned (and possibly reused) string
+	void Render(const T& t, std::string* output) const
+	{
+		const auto start = output->size();
+		StringSink sink{output};
+		sink.Reserve(estimate->Guess());
+		program->Run(t, sink);
+		estimate->Add(output->size() - start);
+	}
+
+	// allocate the temporaries of the render from the memory resource
+	void Render(const T& t, Sink& sink, std::pmr::memory_resource* memory) const
+	{
+		// a sink doesn't know its size, so count what is written to update the estimate
+		MeasuringSink measured{&sink};
+		measured.Reserve(estimate->Guess());
+		program->Run(t, measured, memory);
+		estimate->Add(measured.written);
+	}
+
+	// append the output to a string, the temporaries use the memory resource of the string
+	void Render(const T& t, std::pmr::string* output) const
+	{
+		const auto start = output->size();
+		PmrStringSink sink{output};
+		sink.Reserve(estimate->Guess());
+		program->Run(t, sink, output->get_allocator().resource());
+		estimate->Add(output->size() - start);
+	}
+
+	// Everything the render allocates, the output included, comes from the memory resource.
+	// With a monotonic buffer per request all of it is released at once when the request is done.
+	std::pmr::string Render(const T& t, std::pmr::memory_resource* memory) const
+	{
+		std::pmr::string output{memory};
+		Render(t, &output);
+		return output;
+	}
+
+	// measure each node, see Profiler
+	void Render(const T& t, Sink& sink, Profiler* profiler) const
+	{
+		program->Run(t, sink, profiler);
+	}
+
+	std::string Render(const T& t) const
+	{
+		std::string output;
+		Render(t, &output);
+		return output;
+	}
+
+	const forma::Program<T>& GetProgram() const
+	{
+		return *program;
+	}
+
+	// the files this was built from, empty if the build failed
+	const std::vector<std::string>& Files() const
+	{
+		return files;
+	}
+
+	// the number of bytes reserved before each render
+	std::size_t EstimatedSize() const
+	{
+		return estimate->Guess();
+	}
+
+   private:
+
+	static std::size_t StaticSize(const forma::Program<T>& p)
+	{
+		std::size_t size = 0;
+		for (const auto& in: p.Code)
+		{
+			if (in.Op == OpCode::EmitText)
+			{
+				size += in.B;
+			}
+		}
+		return size;
+	}
+
+	std::shared_ptr<const forma::Program<T>> program;
+	std::vector<std::string> files;
+	std::shared_ptr<SizeEstimate> estimate;
+};
+
+template<typename T>
+using TemplateResult = std::pair<Template<T>, std::vector<Error>>;
+
+// opt-in parallel rendering of a single list
+// Lists with at least Threshold children are split in chunks that are rendered on the pool
+// and written in order. The child getters and functions will be called from several threads.
+struct ParallelList
+{
+	ThreadPool* Pool = nullptr;  // null renders the list on the calling thread
+	std::size_t Threshold = 4096;
+};
+
 template<typename TParent>
 class Definition
 {
-	std::unordered_map<std::string, std::function<std::string(const TParent&)>> attributes;
+
+	struct Member
+	{
+		void (*Write)(const TParent&, Sink&);
+		Value (*Read)(const TParent&);
+	};
+
+	std::unordered_map<std::string, std::function<Value(const TParent&)>> attributes;
+	std::unordered_map<std::string, Member> members;
 	std::unordered_map<std::string, std::function<bool(const TParent&)>> bools;
-	using ChildrenRet = std::pair<std::function<std::string(TParent)>, std::vector<Error>>;
-	using ChildMapFunction = std::function<ChildrenRet(std::shared_ptr<Node>)>;
+	using ChildrenRet = std::pair<ListFunction<TParent>, std::vector<Error>>;
+	using ChildMapFunction
+		= std::function<ChildrenRet(const Ast&, NodeIndex, std::pmr::memory_resource*)>;
 	std::unordered_map<std::string, ChildMapFunction> children;
 
-	static std::string SyntaxError(const TParent&)
+	static std::uint32_t AsIndex(std::size_t i)
 	{
-		return "Syntax error";
+		return static_cast<std::uint32_t>(i);
 	}
 
    public:
 
-	Definition<TParent>& AddVar(std::string name, std::function<std::string(const TParent&)> getter)
+	// The getter returns a string, a number or a bool.
+	// Return a reference to a string to render it without a copy.
+	template<typename TGetter>
+	Definition<TParent>& AddVar(std::string name, TGetter getter)
+	{
+		attributes.insert(
+			{name, [getter](const TParent& parent) -> Value { return MakeValue(getter(parent)); }}
+		);
+		return *this;
+	}
+
+	// Bind a data member directly, the renderer reads it without a getter or a copy.
+	// Strings are written as is, numbers are formatted with std::to_chars and bools
+	// are added as bools.
+	template<auto Member>
+	Definition<TParent>& AddMember(std::string name)
 	{
-		attributes.insert({name, getter});
+		using Type = std::remove_cvref_t<decltype(std::declval<const TParent&>().*Member)>;
+		if constexpr (std::is_same_v<Type, bool>)
+		{
+			bools.insert({name, [](const TParent& parent) { return parent.*Member; }});
+		}
+		else
+		{
+			members.insert({name, {&WriteMember<Member>, &ReadMember<Member>}});
+		}
 		return *this;
 	}
 
@@ -69,34 +269,69 @@ class Definition
 		return *this;
 	}
 
-	template<typename TChild>
+	// The selector returns the children of the parent, as any range of TChild or of const TChild*.
+	// Return a reference or a view (like a std::span) to the parents own container to render
+	// the list without allocating anything, a range is only iterated once so it can be lazy.
+	template<typename TChild, typename TSelector>
 	Definition<TParent>& AddList(
 		std::string name,
-		std::function<std::vector<const TChild*>(const TParent&)> childSelector,
-		Definition<TChild> childDef
+		TSelector childSelector,
+		Definition<TChild> childDef,
+		ParallelList parallel = {}
 	)
 	{
+		using Children = std::invoke_result_t<const TSelector&, const TParent&>;
+		static_assert(
+			std::ranges::input_range<Children>,
+			"the child selector must return a range of children"
+		);
+
 		children.insert(
 			{name,
-			 [=](std::shared_ptr<Node> node) -> ChildrenRet
+			 [=](const Ast& ast, NodeIndex node, std::pmr::memory_resource* memory) -> ChildrenRet
 			 {
-				 auto [getter, errors] = childDef.Validate(node);
+				 auto [body, errors] = childDef.Validate(ast, node, {}, memory);
 				 if (errors.size() > 0)
 				 {
-					 return {SyntaxError, errors};
+					 return {nullptr, errors};
 				 }
 
 				 return {
-					 [=](const TParent& parent)
+					 [=](const TParent& parent,
+						 Sink& sink,
+						 Profiler* profiler,
+						 std::pmr::memory_resource* memory)
 					 {
-						 const auto selected = childSelector(parent);
-						 std::string ret;
-						 for (const TChild* c: selected)
+						 // keeps the returned container alive or refers to the parents container
+						 Children&& selected = childSelector(parent);
+						 if constexpr (std::ranges::random_access_range<Children>
+									   && std::ranges::sized_range<Children>)
+						 {
+							 // a profiler is single threaded so profiled lists are always serial
+							 if (parallel.Pool != nullptr && profiler == nullptr
+								 && std::ranges::size(selected) >= parallel.Threshold)
+							 {
+								 RenderChunked(body, selected, parallel.Pool, sink, memory);
+								 return;
+							 }
+						 }
+						 // the parent render has already reserved the output
+						 const auto& child_program = body.GetProgram();
+						 // the temporaries of a child are reused by the next child instead of
+						 // growing a monotonic resource with every child
+						 ScratchPool pool{memory};
+						 if (profiler != nullptr)
+						 {
+							 for (const auto& c: selected)
+							 {
+								 child_program.Run(Child<TChild>(c), sink, profiler, &pool);
+							 }
+							 return;
+						 }
+						 for (const auto& c: selected)
 						 {
-							 const std::string& val = getter(*c);
-							 ret += val;
+							 child_program.Run(Child<TChild>(c), sink, &pool);
 						 }
-						 return ret;
 					 },
 					 NoErrors()
 				 };
@@ -105,124 +340,248 @@ class Definition
 		return *this;
 	}
 
-	using GetterFunction = std::function<std::string(const TParent&)>;
-	using ValidationResult = std::pair<GetterFunction, std::vector<Error>>;
+	TemplateResult<TParent> Validate(const Ast& ast) const
+	{
+		return Validate(ast, ast.Root, ast.Files());
+	}
+
+	// the program is allocated from the memory resource
+	TemplateResult<TParent> Validate(
+		const Ast& ast,
+		NodeIndex node,
+		std::vector<std::string> files = {},
+		std::pmr::memory_resource* memory = std::pmr::get_default_resource()
+	) const
+	{
+		auto program = forma::Program<TParent>{memory};
+		auto errors = Compile(ast, node, &program);
+		if (errors.empty() == false)
+		{
+			return {Template<TParent>{TextProgram<TParent>("Syntax error")}, errors};
+		}
+		return {Template<TParent>{std::move(program), std::move(files)}, NoErrors()};
+	}
+
+   private:
+
+	template<auto Member>
+	static void WriteMember(const TParent& parent, Sink& sink)
+	{
+		const auto& value = parent.*Member;
+		using Type = std::remove_cvref_t<decltype(value)>;
+		if constexpr (std::is_convertible_v<const Type&, std::string_view>)
+		{
+			sink.Write(value);
+		}
+		else
+		{
+			static_assert(std::is_arithmetic_v<Type>, "members must be strings, numbers or bools");
+			char buffer[64];
+			const auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			sink.Write(std::string_view{buffer, static_cast<std::size_t>(end - buffer)});
+		}
+	}
+
+	template<auto Member>
+	static Value ReadMember(const TParent& parent)
+	{
+		return MakeValue(parent.*Member);
+	}
+
+	template<typename TChild, typename TItem>
+	static const TChild& Child(const TItem& item)
+	{
+		if constexpr (std::is_pointer_v<TItem>)
+		{
+			return *item;
+		}
+		else
+		{
+			return item;
+		}
+	}
+
+	template<typename TChild, typename TChildren>
+	static void RenderChunked(
+		const Template<TChild>& body,
+		TChildren& selected,
+		ThreadPool* pool,
+		Sink& sink,
+		std::pmr::memory_resource* memory
+	)
+	{
+		// the chunks are rendered on the pool, so lock the resource unless it already is safe
+		// each chunk recycles its temporaries in its own pool, so the threads only meet in the
+		// lock when a pool or a chunk needs more memory
+		LockedResource locked{memory};
+		auto* shared = memory == std::pmr::new_delete_resource() ? memory : &locked;
+
+		// a few chunks per thread so the threads can steal, each chunk is rendered in order
+		const auto count = static_cast<std::size_t>(std::ranges::size(selected));
+		const auto chunk_count = std::min(count, pool->Slots() * 4);
+		const auto& child_program = body.GetProgram();
+		std::pmr::vector<std::pmr::string> chunks(chunk_count, shared);
+		pool->ForEach(
+			chunk_count,
+			[&](std::size_t chunk, std::size_t)
+			{
+				const auto begin = count * chunk / chunk_count;
+				const auto end = count * (chunk + 1) / chunk_count;
+				const auto first = std::ranges::begin(selected);
+
+				ScratchPool scratch{shared};
+				PmrStringSink chunk_sink{&chunks[chunk]};
+				chunk_sink.Reserve(body.EstimatedSize() * (end - begin));
+				for (auto index = begin; index < end; index += 1)
+				{
+					const auto offset = static_cast<std::ranges::range_difference_t<TChildren>>(index);
+					child_program.Run(Child<TChild>(first[offset]), chunk_sink, &scratch);
+				}
+			}
+		);
+
+		// reserve it all up front so the join is a single copy per chunk
+		std::size_t size = 0;
+		for (const auto& chunk: chunks)
+		{
+			size += chunk.size();
+		}
+		sink.Reserve(size);
+		for (const auto& chunk: chunks)
+		{
+			sink.Write(chunk);
+		}
+	}
+
+	static std::vector<Error> ApplyToAttribute(
+		std::function<Value(const TParent&)> getter,
+		const Func& function,
+		forma::Program<TParent>* program
+	)
+	{
+		program->Emit(
+			OpCode::ApplyToAttribute,
+			AsIndex(program->Functions.size()),
+			AsIndex(program->Attributes.size())
+		);
+		program->Functions.emplace_back(function);
+		program->Attributes.emplace_back(std::move(getter));
+		return NoErrors();
+	}
 
-	ValidationResult Validate(std::shared_ptr<Node> node) const
+	std::vector<Error> Compile(const Ast& ast, NodeIndex index, forma::Program<TParent>* program)
+		const
 	{
-		if (auto* text = node->AsText())
+		const auto& node = ast[index];
+		if (const auto* text = std::get_if<node::Text>(&node))
 		{
-			const auto value = text->Value;
-			return {[value](const TParent&) { return value; }, NoErrors()};
+			program->AddSource({text->Location, SourceKind::Text, "text"});
+			program->EmitText(text->Value);
+			return NoErrors();
 		}
-		else if (auto* attribute = node->AsAttribute())
+		else if (const auto* attribute = std::get_if<node::Attribute>(&node))
 		{
+			program->AddSource({attribute->Location, SourceKind::Attribute, attribute->Name});
+			if (const auto member = members.find(attribute->Name); member != members.end())
+			{
+				program->Emit(OpCode::EmitMember, AsIndex(program->Members.size()));
+				program->Members.emplace_back(member->second.Write);
+				return NoErrors();
+			}
+
 			const auto getter = attributes.find(attribute->Name);
 			if (getter == attributes.end())
 			{
-				return {
-					SyntaxError,
-					{Error{
-						attribute->Location,
-						Fmt{} << "Missing attribute " << attribute->Name << ": "
-							  << MatchStrings(attribute->Name, KeysOf(attributes))
-					}}
-				};
+				auto names = KeysOf(attributes);
+				const auto member_names = KeysOf(members);
+				names.insert(names.end(), member_names.begin(), member_names.end());
+				return {Error{
+					attribute->Location,
+					Fmt{} << "Missing attribute " << attribute->Name << ": "
+						  << MatchStrings(attribute->Name, names)
+				}};
 			}
-			const auto& getter_func = getter->second;
-			return {
-				[getter_func](const TParent& parent) { return getter_func(parent); }, NoErrors()
-			};
+			program->Emit(OpCode::EmitAttribute, AsIndex(program->Attributes.size()));
+			program->Attributes.emplace_back(getter->second);
+			return NoErrors();
 		}
-		else if (auto* check = node->AsIf())
+		else if (const auto* check = std::get_if<node::If>(&node))
 		{
+			program->AddSource({check->Location, SourceKind::If, "if " + check->Name});
 			const auto getter = bools.find(check->Name);
 			if (getter == bools.end())
 			{
-				return {
-					SyntaxError,
-					{Error{
-						check->Location,
-						Fmt{} << "Missing bool " << check->Name << ": "
-							  << MatchStrings(check->Name, KeysOf(bools))
-					}}
-				};
-			}
-
-			const auto [body, errors] = Validate(check->Body);
-			if (errors.empty() == false)
-			{
-				return {SyntaxError, errors};
+				return {Error{
+					check->Location,
+					Fmt{} << "Missing bool " << check->Name << ": "
+						  << MatchStrings(check->Name, KeysOf(bools))
+				}};
 			}
 
-			const auto getter_func = getter->second;
-			return {
-				[getter_func, body](const TParent& parent) -> std::string
-				{ return getter_func(parent) ? body(parent) : ""; },
-				NoErrors()
-			};
+			const auto jump = program->Emit(OpCode::JumpIfFalse, AsIndex(program->Bools.size()));
+			program->Bools.emplace_back(getter->second);
+			auto errors = Compile(ast, check->Body, program);
+			program->Code[jump].B = program->JumpTarget();
+			return errors;
 		}
-		else if (auto* iterate = node->AsIterate())
+		else if (const auto* iterate = std::get_if<node::Iterate>(&node))
 		{
+			program->AddSource({iterate->Location, SourceKind::Range, "range " + iterate->Name});
 			auto validator = children.find(iterate->Name);
 			if (validator == children.end())
 			{
-				return {
-					SyntaxError,
-					{Error{
-						iterate->Location,
-						Fmt{} << "Missing array " << iterate->Name << ": "
-							  << MatchStrings(iterate->Name, KeysOf(children))
-					}}
-				};
+				return {Error{
+					iterate->Location,
+					Fmt{} << "Missing array " << iterate->Name << ": "
+						  << MatchStrings(iterate->Name, KeysOf(children))
+				}};
 			}
-			return validator->second(iterate->Body);
+			// the child programs use the same memory as the parent
+			auto [list, errors]
+				= validator->second(ast, iterate->Body, program->Code.get_allocator().resource());
+			program->Emit(OpCode::EmitList, AsIndex(program->Lists.size()));
+			program->Lists.emplace_back(std::move(list));
+			return errors;
 		}
-		else if (auto* fc = node->AsFunctionCall())
+		else if (const auto* fc = std::get_if<node::FunctionCall>(&node))
 		{
-			auto [getter, errors] = Validate(fc->Arg);
-			if (errors.empty() == false)
+			const auto call = program->AddSource({fc->Location, SourceKind::Function, fc->Name});
+			// pass attributes directly so the function gets the typed value
+			if (const auto* arg = std::get_if<node::Attribute>(&ast[fc->Arg]))
 			{
-				return {SyntaxError, errors};
+				if (const auto member = members.find(arg->Name); member != members.end())
+				{
+					return ApplyToAttribute(member->second.Read, fc->Function, program);
+				}
+				if (const auto getter = attributes.find(arg->Name); getter != attributes.end())
+				{
+					return ApplyToAttribute(getter->second, fc->Function, program);
+				}
 			}
 
-			auto func = fc->Function;
-			return {
-				[getter, func](const TParent& parent) { return func(getter(parent)); }, NoErrors()
-			};
+			// functions work on the whole argument so it needs to be captured first
+			program->Emit(OpCode::BeginCapture);
+			auto errors = Compile(ast, fc->Arg, program);
+			program->Current = call;
+			program->Emit(OpCode::CallFunction, AsIndex(program->Functions.size()));
+			program->Functions.emplace_back(fc->Function);
+			return errors;
 		}
-		else if (auto* gr = node->AsGroup())
+		else if (const auto* gr = std::get_if<node::Group>(&node))
 		{
-			std::vector<GetterFunction> getters;
 			std::vector<Error> errors;
-			for (auto& n: gr->Nodes)
+			for (const auto n: ast.MembersOf(*gr))
 			{
-				auto [getter, local_errors] = Validate(n);
-				getters.emplace_back(std::move(getter));
+				auto local_errors = Compile(ast, n, program);
 				errors.insert(errors.end(), local_errors.begin(), local_errors.end());
 			}
-			if (errors.empty() == false)
-			{
-				return {SyntaxError, errors};
-			}
-			return {
-				[getters](const TParent& parent)
-				{
-					std::ostringstream ss;
-					for (const auto& g: getters)
-					{
-						ss << g(parent);
-					}
-					return ss.str();
-				},
-				NoErrors()
-			};
+			return errors;
 		}
 		else
 		{
 			assert(false);
 
-			return {SyntaxError, {Error{UnknownLocation(), "error: unknown type"}}};
+			return {Error{UnknownLocation(), "error: unknown type"}};
 		}
 	}
 };
@@ -231,31 +590,71 @@ template<typename T>
 using BuildResult = std::pair<std::function<std::string(const T&)>, std::vector<Error>>;
 
 template<typename T>
-BuildResult<T> Build(
+TemplateResult<T> BuildTemplate(
 	std::string path,
 	VfsRead* vfs,
 	DirectoryInfo* includeDir,
 	std::unordered_map<std::string, FuncGenerator> functions,
-	Definition<T> definition
+	Definition<T> definition,
+	IncludeCache* cache = nullptr,
+	int maxIncludeDepth = DefaultMaxIncludeDepth,
+	PhaseMemory* memory = nullptr
 )
 {
-	auto source = vfs->ReadAllText(path);
-	auto [tokens, lexerErrors] = Scan(path, source);
-	if (lexerErrors.size() > 0)
+	auto [ast, parseErrors]
+		= ParseFile(path, vfs, includeDir, functions, cache, maxIncludeDepth, memory);
+	if (parseErrors.size() > 0)
 	{
-		return BuildResult<T>{[](const T&) { return "Lexing failed"; }, lexerErrors};
+		const auto& failed = std::get<node::Text>(ast[ast.Root]);
+		return {Template<T>{TextProgram<T>(failed.Value)}, parseErrors};
 	}
 
-	auto [node, parseErrors]
-		= forma::Parse(tokens, functions, includeDir, vfs->GetExtension(path), vfs);
-	if (parseErrors.size() > 0)
+	auto* build_memory = memory != nullptr ? &memory->Build : std::pmr::get_default_resource();
+	return definition.Validate(ast, ast.Root, ast.Files(), build_memory);
+}
+
+// same as BuildTemplate but returns the template as a plain string function
+template<typename T>
+BuildResult<T> Build(
+	std::string path,
+	VfsRead* vfs,
+	DirectoryInfo* includeDir,
+	std::unordered_map<std::string, FuncGenerator> functions,
+	Definition<T> definition,
+	IncludeCache* cache = nullptr,
+	int maxIncludeDepth = DefaultMaxIncludeDepth,
+	PhaseMemory* memory = nullptr
+)
+{
+	auto [compiled, errors] = BuildTemplate(
+		path,
+		vfs,
+		includeDir,
+		std::move(functions),
+		std::move(definition),
+		cache,
+		maxIncludeDepth,
+		memory
+	);
+	if (memory == nullptr)
 	{
-		return BuildResult<T>{[](const T&) { return "Parsing failed"; }, parseErrors};
+		return {[compiled](const T& t) { return compiled.Render(t); }, std::move(errors)};
 	}
 
-	return definition.Validate(node);
+	auto* render_memory = &memory->Render;
+	return {
+		[compiled, render_memory](const T& t)
+		{
+			std::string output;
+			StringSink sink{&output};
+			compiled.Render(t, sink, render_memory);
+			return output;
+		},
+		std::move(errors)
+	};
 }
 
+// the created functions only hold copies of their arguments and are safe to share between threads
 std::unordered_map<std::string, FuncGenerator> DefaultFunctions();
 
 }  //  namespace forma
@@ -2,10 +2,24 @@
 #include "catch2/matchers/catch_matchers_vector.hpp"
 
 #include "forma/template.hh"
+#include "forma/registry.hh"
+#include "forma/serialize.hh"
+#include "forma/batch.hh"
+#include "forma/mapped_vfs.hh"
 
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <ranges>
+#include <span>
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <filesystem>
+#include <fstream>
+#include <array>
+#include <cstddef>
+#include <memory_resource>
 
 // ====================================================================================================================
 // Test structures
@@ -58,6 +72,16 @@ forma::Definition<Song> MakeSongDef()
 		.AddVar("track", [](const Song& s) { return std::to_string(s.Track); });
 }
 
+// the same as MakeSongDef but bound to the data members
+forma::Definition<Song> MakeSongMemberDef()
+{
+	return forma::Definition<Song>()
+		.AddMember<&Song::Artist>("artist")
+		.AddMember<&Song::Title>("title")
+		.AddMember<&Song::Album>("album")
+		.AddMember<&Song::Track>("track");
+}
+
 forma::Definition<SongWithoutAlbum> MakeSongWithoutAlbumDef()
 {
 	return forma::Definition<SongWithoutAlbum>()
@@ -130,6 +154,56 @@ struct VfsReadTest : forma::VfsRead
 	}
 };
 
+// keeps the files around, for tests that read files several times
+struct VfsMemoryTest : VfsReadTest
+{
+	std::string ReadAllText(const std::string& path) override
+	{
+		const auto found = contents.find(path);
+		if (found == contents.end()) return "failed to find file";
+		return found->second;
+	}
+
+	void SetContent(const std::string& name, const std::string& content)
+	{
+		contents.insert_or_assign(name, content);
+	}
+};
+
+// someone else changes a file right after it has been read
+struct VfsEditedTest : VfsMemoryTest
+{
+	std::string edited;
+	std::string replacement;
+
+	std::string ReadAllText(const std::string& path) override
+	{
+		auto ret = VfsMemoryTest::ReadAllText(path);
+		if (path == edited)
+		{
+			SetContent(path, replacement);
+			edited.clear();
+		}
+		return ret;
+	}
+};
+
+// the contents are the stamp, looked up without reading the file through the vfs
+struct ContentsCheckTest : forma::ChangeCheck
+{
+	explicit ContentsCheckTest(VfsReadTest* v)
+		: vfs(v)
+	{
+	}
+
+	std::string Stamp(const std::string& path) override
+	{
+		return vfs->contents[path];
+	}
+
+	VfsReadTest* vfs;
+};
+
 struct DirectoryInfoTest : forma::DirectoryInfo
 {
 	std::string dir;
@@ -148,13 +222,13 @@ struct DirectoryInfoTest : forma::DirectoryInfo
 // ====================================================================================================================
 // actual tests
 
+#define NO_ERRORS(errors) CHECK_THAT(errors, Catch::Matchers::Equals(std::vector<forma::Error>{}))
+
 TEST_CASE("all")
 {
 	DirectoryInfoTest cwd("C:\\");
 	VfsReadTest read;
 
-#define NO_ERRORS(errors) CHECK_THAT(errors, Catch::Matchers::Equals(std::vector<forma::Error>{}))
-
 	SECTION("Test one")
 	{
 		auto file = cwd.GetFile("test.txt");
@@ -279,6 +353,114 @@ TEST_CASE("all")
 	}
 
 
+	SECTION("Test five - included twice")
+	{
+		auto file = cwd.GetFile("test.txt");
+		read.AddContent(file, "{{range songs}}{{include \"include\"}}{{include \"include\"}}{{end}}");
+		read.AddContent(cwd.GetFile("include.txt"), "[{{title}}]");
+
+		auto [evaluator, errors]
+			= forma::Build(file, &read, &cwd, forma::DefaultFunctions(), MakeMixTapeDef());
+
+		CHECK(
+			evaluator(AwesomeMix())
+			== "[I Will Survive][I Will Survive][Smells Like Teen Spirit][Smells Like Teen Spirit]"
+		);
+		NO_ERRORS(errors);
+	}
+
+
+	SECTION("Test five - include cache")
+	{
+		forma::IncludeCache cache;
+		auto functions = forma::DefaultFunctions();
+
+		auto first = cwd.GetFile("first.txt");
+		read.AddContent(first, "{{range songs}}{{include \"include\"}}{{end}}");
+		read.AddContent(cwd.GetFile("include.txt"), "[{{title}}]");
+		auto [first_evaluator, first_errors]
+			= forma::Build(first, &read, &cwd, functions, MakeMixTapeDef(), &cache);
+		NO_ERRORS(first_errors);
+
+		// the test vfs forgets files once read, but the include is still cached
+		auto second = cwd.GetFile("second.txt");
+		read.AddContent(second, "{{range songs}}{{include \"include\"}}!{{end}}");
+		read.AddContent(cwd.GetFile("include.txt"), "this is not used");
+		auto [second_evaluator, second_errors]
+			= forma::Build(second, &read, &cwd, functions, MakeMixTapeDef(), &cache);
+		NO_ERRORS(second_errors);
+
+		CHECK(second_evaluator(AwesomeMix()) == "[I Will Survive]![Smells Like Teen Spirit]!");
+	}
+
+
+	SECTION("Test five - include cycle")
+	{
+		auto file = cwd.GetFile("test.txt");
+		read.AddContent(file, "a{{include \"b\"}}");
+		read.AddContent(cwd.GetFile("b.txt"), "b{{include \"test\"}}");
+
+		auto [evaluator, errors]
+			= forma::Build(file, &read, &cwd, forma::DefaultFunctions(), MakeSongDef());
+
+		REQUIRE(errors.size() == 2);
+		CHECK(errors[1].Message == "Include cycle: C:\\test.txt -> C:\\b.txt -> C:\\test.txt");
+	}
+
+
+	SECTION("Test five - include depth")
+	{
+		auto file = cwd.GetFile("test.txt");
+		read.AddContent(file, "{{include \"a\"}}");
+		read.AddContent(cwd.GetFile("a.txt"), "{{include \"b\"}}");
+		read.AddContent(cwd.GetFile("b.txt"), "b");
+
+		auto [evaluator, errors] = forma::Build(
+			file, &read, &cwd, forma::DefaultFunctions(), MakeSongDef(), nullptr, 1
+		);
+
+		REQUIRE(errors.size() == 2);
+		CHECK(
+			errors[1].Message
+			== "Include depth exceeds 1: C:\\test.txt -> C:\\a.txt -> C:\\b.txt"
+		);
+	}
+
+
+	SECTION("Test five - include depth of a file included before")
+	{
+		auto file = cwd.GetFile("test.txt");
+		read.AddContent(file, "{{include \"b\"}}{{include \"a\"}}");
+		read.AddContent(cwd.GetFile("a.txt"), "{{include \"b\"}}");
+		read.AddContent(cwd.GetFile("b.txt"), "b");
+
+		auto [evaluator, errors] = forma::Build(
+			file, &read, &cwd, forma::DefaultFunctions(), MakeSongDef(), nullptr, 1
+		);
+
+		REQUIRE(errors.size() == 2);
+		CHECK(
+			errors[1].Message
+			== "Include depth exceeds 1: C:\\test.txt -> C:\\a.txt -> C:\\b.txt"
+		);
+	}
+
+
+	SECTION("Test five - only the resolved include is checked for cycles")
+	{
+		// test resolves to the file without the extension, not to the file being parsed
+		auto file = cwd.GetFile("test.txt");
+		read.AddContent(file, "a{{include \"test\"}}");
+		read.AddContent(cwd.GetFile("test"), "b");
+
+		auto [evaluator, errors]
+			= forma::Build(file, &read, &cwd, forma::DefaultFunctions(), MakeSongDef());
+
+		NO_ERRORS(errors);
+		CHECK(evaluator(AbbaSong()) == "ab");
+	}
+
+
 	SECTION("Test six")
 	{
 		auto file = cwd.GetFile("test.txt");
@@ -308,6 +490,866 @@ TEST_CASE("all")
 	}
 }
 
+TEST_CASE("render")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+
+	auto file = cwd.GetFile("test.txt");
+	read.AddContent(file, "{{range songs}}[{{title | upper}}]{{end}}");
+
+	auto [compiled, errors]
+		= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), MakeMixTapeDef());
+	NO_ERRORS(errors);
+
+	SECTION("string")
+	{
+		CHECK(compiled.Render(AwesomeMix()) == "[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]");
+	}
+
+	SECTION("appends to buffer")
+	{
+		std::string buffer = ">";
+		compiled.Render(AwesomeMix(), &buffer);
+		compiled.Render(MixTape{}, &buffer);
+		CHECK(buffer == ">[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]");
+	}
+
+	SECTION("stream")
+	{
+		std::ostringstream ss;
+		forma::StreamSink sink{&ss};
+		compiled.Render(AwesomeMix(), sink);
+		CHECK(ss.str() == "[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]");
+	}
+
+	SECTION("reserves the estimated size")
+	{
+		const auto expected = std::string{"[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]"};
+		CHECK(compiled.EstimatedSize() == 0);
+
+		CHECK(compiled.Render(AwesomeMix()) == expected);
+		CHECK(compiled.EstimatedSize() == expected.size());
+
+		std::string buffer;
+		compiled.Render(AwesomeMix(), &buffer);
+		CHECK(buffer == expected);
+		CHECK(buffer.capacity() >= expected.size());
+	}
+
+	SECTION("a sink updates the estimate")
+	{
+		const auto expected = std::string{"[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]"};
+		std::ostringstream ss;
+		forma::StreamSink sink{&ss};
+		compiled.Render(AwesomeMix(), sink);
+		CHECK(ss.str() == expected);
+		CHECK(compiled.EstimatedSize() == expected.size());
+	}
+}
+
+TEST_CASE("members")
+{
+	struct Stats
+	{
+		std::string_view Name;
+		std::int64_t Count;
+		double Ratio;
+		bool Done;
+	};
+
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+	auto file = cwd.GetFile("test.txt");
+
+	const auto def = forma::Definition<Stats>()
+						 .AddMember<&Stats::Name>("name")
+						 .AddMember<&Stats::Count>("count")
+						 .AddMember<&Stats::Ratio>("ratio")
+						 .AddMember<&Stats::Done>("done");
+
+	SECTION("render")
+	{
+		read.AddContent(file, "{{name}} {{count}} {{ratio}}{{if done}} done{{end}}");
+		auto [compiled, errors]
+			= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), def);
+		NO_ERRORS(errors);
+		CHECK(compiled.Render(Stats{"a", -42, 0.5, true}) == "a -42 0.5 done");
+		CHECK(compiled.Render(Stats{"b", 7, 2, false}) == "b 7 2");
+	}
+
+	SECTION("missing")
+	{
+		read.AddContent(file, "{{nam}}");
+		auto [compiled, errors]
+			= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), def);
+		REQUIRE(errors.size() == 1);
+		CHECK(errors[0].Message.find("name") != std::string::npos);
+	}
+
+	SECTION("same as getters")
+	{
+		const auto source = std::string{
+			"{{artist}} - {{title | title}} ({{album | upper}}) {{track | zfill(3)}} {{track}}"
+		};
+		const auto render = [&](forma::Definition<Song> song_def)
+		{
+			read.AddContent(file, source);
+			auto [compiled, errors]
+				= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), song_def);
+			NO_ERRORS(errors);
+			return compiled.Render(AbbaSong());
+		};
+		const auto with_getters = render(MakeSongDef());
+		CHECK(with_getters == "ABBA - Dancing Queen (ARRIVAL) 002 2");
+		CHECK(render(MakeSongMemberDef()) == with_getters);
+	}
+}
+
+TEST_CASE("values")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+	auto file = cwd.GetFile("test.txt");
+
+	auto functions = forma::DefaultFunctions();
+	functions.insert(
+		{"twice",
+		 [](const forma::Location&, const std::vector<forma::FuncArgument>&)
+		 {
+			 return forma::FuncGeneratorResult{
+				 forma::StringFunc([](std::string s) { return s + s; }), forma::NoErrors()
+			 };
+		 }}
+	);
+
+	const auto def
+		= forma::Definition<Song>()
+			  .AddVar("title", [](const Song& s) -> const std::string& { return s.Title; })
+			  .AddVar("track", [](const Song& s) { return s.Track; })
+			  .AddVar("half", [](const Song& s) { return s.Track / 2.0; })
+			  .AddVar("even", [](const Song& s) { return s.Track % 2 == 0; })
+			  .AddMember<&Song::Track>("number");
+	const auto render = [&](const std::string& source, const Song& song)
+	{
+		read.AddContent(file, source);
+		auto [compiled, errors] = forma::BuildTemplate(file, &read, &cwd, functions, def);
+		NO_ERRORS(errors);
+		return compiled.Render(song);
+	};
+
+	const auto song = Song{"Gloria Gaynor", "I Will Survive", "Nevermind", 5};
+
+	CHECK(render("{{title}} {{track}} {{half}} {{even}}", song) == "I Will Survive 5 2.5 false");
+	CHECK(
+		render("{{track | zfill}} {{number | zfill(2)}} {{track | zfill(0)}}", song) == "005 05 5"
+	);
+	CHECK(render("{{track | twice | zfill(4)}}", song) == "0055");
+	CHECK(render("{{title | upper | twice}}", song) == "I WILL SURVIVEI WILL SURVIVE");
+	CHECK(
+		render("{{title | replace_many(I, you, Survive, \"Thrive\")}}", song) == "you Will Thrive"
+	);
+
+	SECTION("string generators")
+	{
+		functions.insert(
+			{"suffix",
+			 forma::FromStringGenerator(
+				 [](const forma::Location&, const std::vector<forma::FuncArgument>& args)
+				 {
+					 const auto suffix = args[0].Argument;
+					 return forma::StringFuncGeneratorResult{
+						 [suffix](std::string s) { return s + suffix; }, forma::NoErrors()
+					 };
+				 }
+			 )}
+		);
+		CHECK(
+			render("{{track | suffix(th)}} {{title | trim | suffix(\"?\")}}", song)
+			== "5th I Will Survive?"
+		);
+	}
+
+	SECTION("temporaries are owned")
+	{
+		const auto title = std::string{"title"};
+		CHECK(std::holds_alternative<std::string_view>(forma::MakeValue(title)));
+		CHECK(std::holds_alternative<std::string>(forma::MakeValue(std::string{"title"})));
+		CHECK(std::holds_alternative<std::string>(forma::MakeValue(std::pmr::string{"title"})));
+
+		const auto pmr_def = forma::Definition<Song>().AddVar(
+			"title", [](const Song& s) { return std::pmr::string{s.Title + " and more"}; }
+		);
+		read.AddContent(file, "{{title}} {{title | upper}}");
+		auto [compiled, errors] = forma::BuildTemplate(file, &read, &cwd, functions, pmr_def);
+		NO_ERRORS(errors);
+		CHECK(compiled.Render(song) == "I Will Survive and more I WILL SURVIVE AND MORE");
+	}
+}
+
+TEST_CASE("compile")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+	auto file = cwd.GetFile("test.txt");
+
+	const auto build = [&](const std::string& source)
+	{
+		read.AddContent(file, source);
+		read.AddContent(cwd.GetFile("part.txt"), "b");
+		auto [compiled, errors]
+			= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), MakeMixTapeDef());
+		NO_ERRORS(errors);
+		return compiled;
+	};
+
+	SECTION("adjacent text is merged")
+	{
+		const auto compiled = build("a{{include part}}c{{- /** comment **/ -}}  d");
+		CHECK(compiled.GetProgram().Code.size() == 1);
+		CHECK(compiled.Render(AwesomeMix()) == "abcd");
+	}
+
+	SECTION("text is not merged over a jump")
+	{
+		const auto compiled = build("{{range songs}}a{{if star}}b{{end}}c{{end}}");
+		CHECK(compiled.Render(AwesomeMix()) == "abcac");
+	}
+}
+
+TEST_CASE("mapped vfs")
+{
+	const auto dir = std::filesystem::temp_directory_path() / "forma-mapped-vfs-test";
+	std::filesystem::create_directories(dir);
+	const auto write = [&](const std::string& name, const std::string& content)
+	{
+		std::ofstream{dir / name, std::ios::binary} << content;
+	};
+	write("test.txt", "{{range songs}}[{{include song}}]{{end}}");
+	write("song.txt", "{{title}}");
+	write("empty.txt", "");
+
+	forma::MappedVfs vfs;
+	DirectoryInfoTest cwd((dir / "").string());
+
+	SECTION("reads")
+	{
+		const auto path = cwd.GetFile("song.txt");
+		CHECK(vfs.Exists(path));
+		CHECK_FALSE(vfs.Exists(cwd.GetFile("missing.txt")));
+		CHECK(vfs.GetExtension(path) == ".txt");
+		CHECK(vfs.ReadAllText(path) == "{{title}}");
+		CHECK(vfs.ReadSource(path).Text == "{{title}}");
+		CHECK(vfs.ReadSource(cwd.GetFile("empty.txt")).Text.empty());
+		CHECK(vfs.ReadSource(cwd.GetFile("empty.txt")).Error.empty());
+		CHECK(vfs.ReadSource(cwd.GetFile("missing.txt")).Error.empty() == false);
+	}
+
+	SECTION("unreadable files are errors")
+	{
+		const auto missing = cwd.GetFile("missing.txt");
+		auto [compiled, errors] = forma::BuildTemplate(
+			missing, &vfs, &cwd, forma::DefaultFunctions(), MakeMixTapeDef()
+		);
+		REQUIRE(errors.size() == 1);
+		CHECK(errors[0].Message.starts_with("Unable to read " + missing + ": "));
+	}
+
+	SECTION("builds")
+	{
+		auto [compiled, errors] = forma::BuildTemplate(
+			cwd.GetFile("test.txt"), &vfs, &cwd, forma::DefaultFunctions(), MakeMixTapeDef()
+		);
+		NO_ERRORS(errors);
+		CHECK(compiled.Render(AwesomeMix()) == "[I Will Survive][Smells Like Teen Spirit]");
+	}
+
+	std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("profiler")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+
+	auto file = cwd.GetFile("test.txt");
+	read.AddContent(file, "{{range songs}}[{{include song}}]{{end}}");
+	read.AddContent(cwd.GetFile("song.txt"), "{{title | upper}}");
+	auto [compiled, errors]
+		= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), MakeMixTapeDef());
+	NO_ERRORS(errors);
+
+	forma::Profiler profiler;
+	std::string output;
+	forma::StringSink sink{&output};
+	compiled.Render(AwesomeMix(), sink, &profiler);
+	CHECK(output == "[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]");
+
+	std::uint64_t bytes = 0;
+	for (const auto& [name, stats]: profiler.ByNode())
+	{
+		bytes += stats.Bytes;
+	}
+	CHECK(bytes == output.size());
+
+	const auto functions = profiler.ByFunction();
+	REQUIRE(functions.size() == 1);
+	CHECK(functions[0].first == "upper");
+	CHECK(functions[0].second.Calls == 2);
+	CHECK(functions[0].second.Bytes == std::string{"I WILL SURVIVESMELLS LIKE TEEN SPIRIT"}.size());
+
+	const auto files = profiler.ByFile();
+	CHECK(files.size() == 2);
+
+	const auto stacks = profiler.CollapsedStacks();
+	CHECK(stacks.find("range songs (C:\\test.txt:1:") != std::string::npos);
+	CHECK(stacks.find(";| upper (C:\\song.txt:1:") != std::string::npos);
+	CHECK(profiler.Report().find("functions") != std::string::npos);
+}
+
+TEST_CASE("phase memory")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+
+	auto file = cwd.GetFile("test.txt");
+	read.AddContent(file, "{{range songs}}[{{include song}}]{{end}}");
+	read.AddContent(cwd.GetFile("song.txt"), "{{title | lower | upper}}");
+
+	forma::PhaseMemory memory;
+	auto [compiled, errors] = forma::BuildTemplate(
+		file,
+		&read,
+		&cwd,
+		forma::DefaultFunctions(),
+		MakeMixTapeDef(),
+		nullptr,
+		forma::DefaultMaxIncludeDepth,
+		&memory
+	);
+	NO_ERRORS(errors);
+	CHECK(memory.Scan.Stats().Allocations > 0);
+	CHECK(memory.Scan.Stats().InUse == 0);  // the tokens are gone once parsed
+	CHECK(memory.Parse.Stats().Allocations > 0);
+	CHECK(memory.Build.Stats().InUse > 0);  // the program is kept by the template
+	CHECK(memory.Render.Stats().Allocations == 0);
+
+	SECTION("render")
+	{
+		std::string output;
+		forma::StringSink sink{&output};
+		compiled.Render(AwesomeMix(), sink, &memory.Render);
+		CHECK(output == "[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]");
+
+		// the captured function arguments
+		const auto stats = memory.Render.Stats();
+		CHECK(stats.Allocations > 0);
+		CHECK(stats.Peak > 0);
+		CHECK(stats.InUse == 0);
+
+		// a render without the resource isn't counted
+		compiled.Render(AwesomeMix(), &output);
+		CHECK(memory.Render.Stats().Allocations == stats.Allocations);
+		CHECK(memory.Report().find("render") != std::string::npos);
+	}
+
+	SECTION("output")
+	{
+		{
+			const auto output = compiled.Render(AwesomeMix(), &memory.Render);
+			CHECK(output == "[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]");
+			CHECK(memory.Render.Stats().InUse >= output.size());
+		}
+		CHECK(memory.Render.Stats().InUse == 0);
+
+		// a fixed buffer, anything that doesn't fit would throw
+		std::array<std::byte, 4096> buffer;
+		std::pmr::monotonic_buffer_resource arena{
+			buffer.data(), buffer.size(), std::pmr::null_memory_resource()
+		};
+		std::pmr::string output{&arena};
+		compiled.Render(AwesomeMix(), &output);
+		CHECK(output == "[I WILL SURVIVE][SMELLS LIKE TEEN SPIRIT]");
+	}
+
+	SECTION("reset")
+	{
+		memory.Reset();
+		CHECK(memory.Build.Stats().Allocations == 0);
+		CHECK(memory.Build.Stats().Peak == memory.Build.Stats().InUse);
+	}
+
+	SECTION("scan")
+	{
+		forma::CountingResource counting;
+		{
+			auto [tokens, scan_errors] = forma::Scan("test.txt", "a{{b}}c", &counting);
+			NO_ERRORS(scan_errors);
+			CHECK(counting.Stats().InUse >= tokens.size() * sizeof(forma::Token));
+		}
+		CHECK(counting.Stats().InUse == 0);
+	}
+}
+
+TEST_CASE("parser")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+
+	const std::string source = "a{{range songs}}{{title | upper}}{{end}}b";
+	auto [tokens, scanErrors] = forma::Scan("test.txt", source);
+	NO_ERRORS(scanErrors);
+	// tokens are views into the source
+	REQUIRE(tokens.empty() == false);
+	CHECK(tokens[0].Value.data() == source.data());
+
+	auto [ast, parseErrors] = forma::Parse(tokens, forma::DefaultFunctions(), &cwd, ".txt", &read);
+	NO_ERRORS(parseErrors);
+
+	const auto* root = std::get_if<forma::node::Group>(&ast[ast.Root]);
+	REQUIRE(root != nullptr);
+	const auto members = ast.MembersOf(*root);
+	REQUIRE(members.size() == 3);
+	CHECK(std::get_if<forma::node::Text>(&ast[members[0]])->Value == "a");
+	CHECK(std::get_if<forma::node::Text>(&ast[members[2]])->Value == "b");
+
+	const auto* range = std::get_if<forma::node::Iterate>(&ast[members[1]]);
+	REQUIRE(range != nullptr);
+	CHECK(range->Name == "songs");
+
+	const auto* body = std::get_if<forma::node::Group>(&ast[range->Body]);
+	REQUIRE(body != nullptr);
+	REQUIRE(body->Count == 1);
+	const auto* call = std::get_if<forma::node::FunctionCall>(&ast[ast.MembersOf(*body)[0]]);
+	REQUIRE(call != nullptr);
+	CHECK(call->Name == "upper");
+	CHECK(std::get_if<forma::node::Attribute>(&ast[call->Arg])->Name == "title");
+}
+
+TEST_CASE("includes")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsMemoryTest read;
+	const auto functions = forma::DefaultFunctions();
+
+	SECTION("the includes of a file included before are checked against the depth")
+	{
+		auto file = cwd.GetFile("test.txt");
+		read.SetContent(file, "{{include \"a\"}}{{include \"x\"}}");
+		read.SetContent(cwd.GetFile("x.txt"), "{{include \"a\"}}");
+		read.SetContent(cwd.GetFile("a.txt"), "{{include \"b\"}}");
+		read.SetContent(cwd.GetFile("b.txt"), "{{include \"c\"}}");
+		read.SetContent(cwd.GetFile("c.txt"), "c");
+
+		auto [evaluator, errors]
+			= forma::Build(file, &read, &cwd, functions, MakeSongDef(), nullptr, 3);
+
+		REQUIRE(errors.empty() == false);
+		CHECK(
+			errors.back().Message
+			== "Include depth exceeds 3: C:\\test.txt -> C:\\x.txt -> C:\\a.txt -> C:\\b.txt -> "
+			   "C:\\c.txt"
+		);
+	}
+
+	SECTION("a include that can't be read")
+	{
+		struct VfsUnreadableTest : VfsMemoryTest
+		{
+			forma::SourceText ReadSource(const std::string& path) override
+			{
+				if (path.ends_with("b.txt")) return {{}, nullptr, "permission denied"};
+				return VfsMemoryTest::ReadSource(path);
+			}
+		};
+		VfsUnreadableTest unreadable;
+		auto file = cwd.GetFile("test.txt");
+		unreadable.SetContent(file, "a{{include \"b\"}}");
+		unreadable.SetContent(cwd.GetFile("b.txt"), "b");
+
+		auto [evaluator, errors] = forma::Build(file, &unreadable, &cwd, functions, MakeSongDef());
+		REQUIRE(errors.size() == 1);
+		CHECK(errors[0].Message == "Unable to read C:\\b.txt: permission denied");
+	}
+
+	SECTION("a cached include is checked against the include chain")
+	{
+		forma::IncludeCache cache;
+		read.SetContent(cwd.GetFile("a.txt"), "{{include \"b\"}}");
+		read.SetContent(cwd.GetFile("b.txt"), "{{include \"c\"}}");
+		read.SetContent(cwd.GetFile("c.txt"), "c");
+		auto [first, first_errors]
+			= forma::Build(cwd.GetFile("a.txt"), &read, &cwd, functions, MakeSongDef(), &cache);
+		NO_ERRORS(first_errors);
+
+		// c -> b is a cycle since b includes c, with or without the cache
+		auto file = cwd.GetFile("c.txt");
+		read.SetContent(file, "{{include \"b\"}}");
+		auto [cold, cold_errors] = forma::Build(file, &read, &cwd, functions, MakeSongDef());
+		auto [warm, warm_errors]
+			= forma::Build(file, &read, &cwd, functions, MakeSongDef(), &cache);
+
+		REQUIRE(warm_errors.empty() == false);
+		CHECK(warm_errors.back().Message == "Include cycle: C:\\c.txt -> C:\\b.txt -> C:\\c.txt");
+		CHECK(warm_errors == cold_errors);
+	}
+
+	SECTION("a cached include is checked against the depth")
+	{
+		forma::IncludeCache cache;
+		read.SetContent(cwd.GetFile("a.txt"), "{{include \"b\"}}");
+		read.SetContent(cwd.GetFile("b.txt"), "{{include \"c\"}}");
+		read.SetContent(cwd.GetFile("c.txt"), "c");
+		auto [first, first_errors]
+			= forma::Build(cwd.GetFile("a.txt"), &read, &cwd, functions, MakeSongDef(), &cache);
+		NO_ERRORS(first_errors);
+
+		auto file = cwd.GetFile("test.txt");
+		read.SetContent(file, "{{include \"a\"}}");
+		auto [cold, cold_errors]
+			= forma::Build(file, &read, &cwd, functions, MakeSongDef(), nullptr, 2);
+		auto [warm, warm_errors]
+			= forma::Build(file, &read, &cwd, functions, MakeSongDef(), &cache, 2);
+
+		REQUIRE(warm_errors.empty() == false);
+		CHECK(
+			warm_errors.back().Message
+			== "Include depth exceeds 2: C:\\test.txt -> C:\\a.txt -> C:\\b.txt -> C:\\c.txt"
+		);
+		CHECK(warm_errors == cold_errors);
+	}
+
+	SECTION("invalidate a cached include")
+	{
+		forma::IncludeCache cache;
+		auto file = cwd.GetFile("test.txt");
+		read.SetContent(file, "{{include \"a\"}}");
+		read.SetContent(cwd.GetFile("a.txt"), "[{{include \"b\"}}]");
+		read.SetContent(cwd.GetFile("b.txt"), "b");
+		auto [first, first_errors]
+			= forma::Build(file, &read, &cwd, functions, MakeSongDef(), &cache);
+		NO_ERRORS(first_errors);
+		CHECK(first(AbbaSong()) == "[b]");
+
+		read.SetContent(cwd.GetFile("b.txt"), "B");
+		auto [cached, cached_errors]
+			= forma::Build(file, &read, &cwd, functions, MakeSongDef(), &cache);
+		NO_ERRORS(cached_errors);
+		CHECK(cached(AbbaSong()) == "[b]");
+
+		// a is dropped as well since it includes b
+		cache.Invalidate(cwd.GetFile("b.txt"));
+		auto [changed, changed_errors]
+			= forma::Build(file, &read, &cwd, functions, MakeSongDef(), &cache);
+		NO_ERRORS(changed_errors);
+		CHECK(changed(AbbaSong()) == "[B]");
+	}
+}
+
+TEST_CASE("registry")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsMemoryTest read;
+	forma::ContentHashCheck check{&read};
+
+	auto file = cwd.GetFile("test.txt");
+	read.SetContent(file, "{{range songs}}{{include \"include\"}}{{end}}");
+	read.SetContent(cwd.GetFile("include.txt"), "[{{title}}]");
+	read.SetContent(cwd.GetFile("other.txt"), "{{range songs}}.{{end}}");
+
+	forma::TemplateRegistry<MixTape> registry{
+		&read, &cwd, forma::DefaultFunctions(), MakeMixTapeDef(), &check
+	};
+
+	const auto first = registry.Get(file);
+	NO_ERRORS(first->Errors);
+	CHECK(first->Compiled.Render(AwesomeMix()) == "[I Will Survive][Smells Like Teen Spirit]");
+	CHECK(registry.Get(file) == first);
+	CHECK(registry.Get(cwd.GetFile("other.txt"))->Compiled.Render(AwesomeMix()) == "..");
+
+	SECTION("nothing changed")
+	{
+		CHECK(registry.Reload().empty());
+		CHECK(registry.Get(file) == first);
+	}
+
+	SECTION("include changed")
+	{
+		read.SetContent(cwd.GetFile("include.txt"), "<{{title}}>");
+		CHECK(registry.Reload() == std::vector<std::string>{file});
+
+		CHECK(
+			registry.Get(file)->Compiled.Render(AwesomeMix())
+			== "<I Will Survive><Smells Like Teen Spirit>"
+		);
+
+		// old entries are still usable
+		CHECK(first->Compiled.Render(AwesomeMix()) == "[I Will Survive][Smells Like Teen Spirit]");
+	}
+
+	SECTION("include changed while building")
+	{
+		VfsEditedTest edited;
+		ContentsCheckTest contents{&edited};
+		edited.SetContent(file, "{{range songs}}{{include \"include\"}}{{end}}");
+		edited.SetContent(cwd.GetFile("include.txt"), "[{{title}}]");
+		edited.edited = cwd.GetFile("include.txt");
+		edited.replacement = "<{{title}}>";
+
+		forma::TemplateRegistry<MixTape> building{
+			&edited, &cwd, forma::DefaultFunctions(), MakeMixTapeDef(), &contents
+		};
+		CHECK(
+			building.Get(file)->Compiled.Render(AwesomeMix())
+			== "[I Will Survive][Smells Like Teen Spirit]"
+		);
+
+		CHECK(building.Reload() == std::vector<std::string>{file});
+		CHECK(
+			building.Get(file)->Compiled.Render(AwesomeMix())
+			== "<I Will Survive><Smells Like Teen Spirit>"
+		);
+	}
+}
+
+TEST_CASE("serialize")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsMemoryTest read;
+	const auto functions = forma::DefaultFunctions();
+
+	auto file = cwd.GetFile("test.txt");
+	read.SetContent(file, "{{range songs}}{{include \"include\"}}{{end}}");
+	read.SetContent(cwd.GetFile("include.txt"), "[{{title | zfill(30)}}]");
+
+	std::string blob;
+	auto [parsed, parse_errors] = forma::LoadOrParseFile(&blob, file, &read, &cwd, functions);
+	NO_ERRORS(parse_errors);
+	REQUIRE(blob.empty() == false);
+
+	const auto expected = MakeMixTapeDef().Validate(parsed).first.Render(AwesomeMix());
+
+	SECTION("load")
+	{
+		auto loaded = forma::LoadAst(blob, &read, functions);
+		REQUIRE(loaded.has_value());
+		CHECK(loaded->Nodes.size() == parsed.Nodes.size());
+
+		auto [compiled, errors] = MakeMixTapeDef().Validate(*loaded);
+		NO_ERRORS(errors);
+		CHECK(compiled.Render(AwesomeMix()) == expected);
+	}
+
+	SECTION("changed include")
+	{
+		read.SetContent(cwd.GetFile("include.txt"), "<{{title}}>");
+		CHECK(forma::LoadAst(blob, &read, functions).has_value() == false);
+
+		const auto old_blob = blob;
+		auto [reparsed, errors] = forma::LoadOrParseFile(&blob, file, &read, &cwd, functions);
+		NO_ERRORS(errors);
+		CHECK(blob != old_blob);
+		CHECK(
+			MakeMixTapeDef().Validate(reparsed).first.Render(AwesomeMix())
+			== "<I Will Survive><Smells Like Teen Spirit>"
+		);
+	}
+
+	SECTION("damaged")
+	{
+		CHECK(forma::LoadAst(blob.substr(0, blob.size() - 1), &read, functions).has_value() == false);
+		CHECK(forma::LoadAst("", &read, functions).has_value() == false);
+	}
+
+	SECTION("missing function")
+	{
+		CHECK(forma::LoadAst(blob, &read, {}).has_value() == false);
+	}
+}
+
+TEST_CASE("lists")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+	auto file = cwd.GetFile("test.txt");
+
+	const auto build = [&](forma::Definition<MixTape> def)
+	{
+		read.AddContent(file, "{{range songs}}[{{title}}]{{end}}");
+		auto [compiled, errors]
+			= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), def);
+		NO_ERRORS(errors);
+		return compiled;
+	};
+
+	SECTION("reference to the container")
+	{
+		const auto compiled = build(forma::Definition<MixTape>().AddList<SongWithoutAlbum>(
+			"songs",
+			[](const MixTape& mt) -> const std::vector<SongWithoutAlbum>& { return mt.Songs; },
+			MakeSongWithoutAlbumDef()
+		));
+		CHECK(compiled.Render(AwesomeMix()) == "[I Will Survive][Smells Like Teen Spirit]");
+	}
+
+	SECTION("span")
+	{
+		const auto compiled = build(forma::Definition<MixTape>().AddList<SongWithoutAlbum>(
+			"songs",
+			[](const MixTape& mt) { return std::span<const SongWithoutAlbum>{mt.Songs}; },
+			MakeSongWithoutAlbumDef()
+		));
+		CHECK(compiled.Render(AwesomeMix()) == "[I Will Survive][Smells Like Teen Spirit]");
+	}
+
+	SECTION("lazy range")
+	{
+		const auto compiled = build(forma::Definition<MixTape>().AddList<SongWithoutAlbum>(
+			"songs",
+			[](const MixTape& mt)
+			{
+				return mt.Songs
+					 | std::views::filter([](const SongWithoutAlbum& s) { return s.Title[0] == 'S'; });
+			},
+			MakeSongWithoutAlbumDef()
+		));
+		CHECK(compiled.Render(AwesomeMix()) == "[Smells Like Teen Spirit]");
+	}
+
+	SECTION("parallel span")
+	{
+		forma::ThreadPool pool{2};
+		auto big = MixTape{};
+		for (int i = 0; i < 100; i += 1)
+		{
+			big.Songs.emplace_back(SongWithoutAlbum{"", std::to_string(i), false});
+		}
+		const auto compiled = build(forma::Definition<MixTape>().AddList<SongWithoutAlbum>(
+			"songs",
+			[](const MixTape& mt) { return std::span<const SongWithoutAlbum>{mt.Songs}; },
+			MakeSongWithoutAlbumDef(),
+			forma::ParallelList{&pool, 10}
+		));
+
+		std::string expected;
+		for (int i = 0; i < 100; i += 1)
+		{
+			expected += "[" + std::to_string(i) + "]";
+		}
+		CHECK(compiled.Render(big) == expected);
+
+		// the chunks are rendered on several threads from the same resource
+		forma::CountingResource memory;
+		{
+			const auto output = compiled.Render(big, &memory);
+			CHECK(output == std::string_view{expected});
+		}
+		CHECK(memory.Stats().Allocations > 1);
+		CHECK(memory.Stats().InUse == 0);
+	}
+}
+
+TEST_CASE("batch")
+{
+	DirectoryInfoTest cwd("C:\\");
+	VfsReadTest read;
+
+	auto file = cwd.GetFile("test.txt");
+	read.AddContent(file, "{{range songs}}[{{title | upper}}]{{end}}");
+	auto [compiled, errors]
+		= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), MakeMixTapeDef());
+	NO_ERRORS(errors);
+
+	std::vector<MixTape> tapes;
+	for (int i = 0; i < 1000; i += 1)
+	{
+		auto tape = MixTape{};
+		tape.Songs.emplace_back(SongWithoutAlbum{"", std::to_string(i), false});
+		tapes.emplace_back(tape);
+	}
+	const auto items = std::span<const MixTape>{tapes};
+
+	forma::ThreadPool pool{4};
+
+	SECTION("separate")
+	{
+		const auto outputs = forma::RenderBatch(compiled, items, &pool);
+		REQUIRE(outputs.size() == tapes.size());
+		CHECK(outputs[0] == "[0]");
+		CHECK(outputs[999] == "[999]");
+	}
+
+	SECTION("joined")
+	{
+		std::string expected;
+		for (const auto& tape: tapes)
+		{
+			compiled.Render(tape, &expected);
+		}
+		CHECK(forma::RenderBatchJoined(compiled, items, &pool) == expected);
+	}
+
+	SECTION("callback")
+	{
+		std::vector<std::string> outputs(tapes.size());
+		forma::RenderBatch(
+			compiled,
+			items,
+			&pool,
+			[&](std::size_t index, std::string_view output) { outputs[index] = output; }
+		);
+		CHECK(outputs[500] == "[500]");
+	}
+
+	SECTION("parallel range")
+	{
+		auto big = MixTape{};
+		for (int i = 0; i < 1000; i += 1)
+		{
+			big.Songs.emplace_back(SongWithoutAlbum{"", std::to_string(i), false});
+		}
+
+		const auto def = forma::Definition<MixTape>().AddList<SongWithoutAlbum>(
+			"songs",
+			[](const MixTape& mt)
+			{
+				std::vector<const SongWithoutAlbum*> r;
+				for (const auto& s: mt.Songs)
+					r.emplace_back(&s);
+				return r;
+			},
+			MakeSongWithoutAlbumDef(),
+			forma::ParallelList{&pool, 16}
+		);
+		read.AddContent(file, "{{range songs}}[{{title | upper}}]{{end}}");
+		auto [parallel, parallel_errors]
+			= forma::BuildTemplate(file, &read, &cwd, forma::DefaultFunctions(), def);
+		NO_ERRORS(parallel_errors);
+
+		CHECK(parallel.Render(big) == compiled.Render(big));
+		CHECK(parallel.Render(tapes[3]) == "[3]");
+	}
+
+	SECTION("nested and throwing")
+	{
+		std::atomic<int> sum = 0;
+		pool.ForEach(
+			10,
+			[&](std::size_t, std::size_t)
+			{ pool.ForEach(10, [&](std::size_t i, std::size_t) { sum += static_cast<int>(i); }); }
+		);
+		CHECK(sum == 450);
+
+		CHECK_THROWS(pool.ForEach(
+			100,
+			[](std::size_t i, std::size_t)
+			{
+				if (i == 50) throw std::runtime_error("fail");
+			}
+		));
+	}
+}
+
 TEST_CASE("basics")
 {
 	SECTION("string trim")
@@ -349,6 +1391,120 @@ TEST_CASE("basics")
 		CHECK(forma::strings::Replace("test", "this", "that") == "test");
 		CHECK(forma::strings::Replace("test this", "this", "that") == "test that");
 		CHECK(forma::strings::Replace("this test this", "this", "that") == "that test that");
+		CHECK(forma::strings::Replace("aaa", "a", "aa") == "aaaaaa");
+		CHECK(forma::strings::Replace("test", "", "x") == "test");
+		CHECK(forma::strings::Replace(std::string(1000, 'a') + "b", "a", "") == "b");
+	}
+
+	SECTION("find")
+	{
+		std::mt19937 rng{1};
+		std::uniform_int_distribution<int> letter{'a', 'c'};
+		const auto random = [&](std::size_t size)
+		{
+			std::string r;
+			for (std::size_t i = 0; i < size; i += 1)
+			{
+				r += static_cast<char>(letter(rng));
+			}
+			return r;
+		};
+
+		for (int round = 0; round < 2000; round += 1)
+		{
+			const auto haystack = random(static_cast<std::size_t>(round % 70));
+			const auto needle = random(static_cast<std::size_t>(round % 5));
+			for (std::size_t start = 0; start <= haystack.size(); start += 7)
+			{
+				const auto found = forma::strings::FindText(haystack, needle, start);
+				REQUIRE(found == haystack.find(needle, start));
+			}
+		}
+	}
+
+	SECTION("replace many")
+	{
+		const auto replace = [](const std::string& text,
+								std::vector<std::pair<std::string, std::string>> replacements)
+		{
+			std::string r;
+			forma::StringSink sink{&r};
+			forma::strings::MultiReplace{std::move(replacements)}.Write(text, sink);
+			return r;
+		};
+
+		CHECK(replace("a cat and a dog", {{"cat", "dog"}, {"dog", "cat"}}) == "a dog and a cat");
+		CHECK(replace("abcde", {{"bc", "1"}, {"abcd", "2"}}) == "2e");
+		CHECK(replace("abcdz", {{"abcde", "1"}, {"a", "2"}, {"c", "3"}}) == "2b3dz");
+		CHECK(replace("she sells", {{"he", "1"}, {"she", "2"}, {"s", "3"}}) == "2 3ell3");
+		CHECK(replace("aaaa", {{"aa", "b"}}) == "bb");
+		CHECK(replace("none", {{"x", "y"}}) == "none");
+		CHECK(replace("", {{"x", "y"}}) == "");
+		CHECK(replace("abcd", {{"abcde", "1"}, {"a", "2"}, {"c", "3"}}) == "2b3d");
+
+		// at each position replace the longest pattern that starts there
+		const auto reference = [](const std::string& text,
+								  const std::vector<std::pair<std::string, std::string>>& patterns)
+		{
+			std::string r;
+			for (std::size_t index = 0; index < text.size();)
+			{
+				const std::pair<std::string, std::string>* longest = nullptr;
+				for (const auto& pattern: patterns)
+				{
+					if (text.compare(index, pattern.first.size(), pattern.first) == 0
+						&& (longest == nullptr || pattern.first.size() > longest->first.size()))
+					{
+						longest = &pattern;
+					}
+				}
+				if (longest == nullptr)
+				{
+					r += text[index];
+					index += 1;
+				}
+				else
+				{
+					r += longest->second;
+					index += longest->first.size();
+				}
+			}
+			return r;
+		};
+
+		std::mt19937 rng{2};
+		std::uniform_int_distribution<int> letter{'a', 'c'};
+		std::uniform_int_distribution<std::size_t> length{1, 4};
+		const auto random = [&](std::size_t size)
+		{
+			std::string r;
+			for (std::size_t i = 0; i < size; i += 1)
+			{
+				r += static_cast<char>(letter(rng));
+			}
+			return r;
+		};
+		for (int round = 0; round < 2000; round += 1)
+		{
+			std::vector<std::pair<std::string, std::string>> patterns;
+			for (int pattern = 0; pattern < 1 + round % 4; pattern += 1)
+			{
+				patterns.emplace_back(random(length(rng)), std::to_string(pattern));
+			}
+			const auto text = random(static_cast<std::size_t>(round % 40));
+			REQUIRE(replace(text, patterns) == reference(text, patterns));
+		}
+	}
+
+	SECTION("views")
+	{
+		const std::string_view source = "  test  ";
+		const auto trimmed = forma::strings::TrimView(source);
+		CHECK(trimmed == "test");
+		CHECK(trimmed.data() == source.data() + 2);
+		CHECK(forma::strings::TrimStartView(source) == "test  ");
+		CHECK(forma::strings::TrimEndView(source) == "  test");
+		CHECK(forma::strings::SubstringView("cat", 1, 1) == "a");
 	}
 
 	SECTION("substring")
@@ -358,3 +1514,141 @@ TEST_CASE("basics")
 		CHECK(forma::strings::Substring("cat", 1, 10) == "at");
 	}
 }
+
+// ====================================================================================================================
+// case conversion, compared to the simple one character at a time versions
+
+namespace
+{
+char ReferenceLower(char c)
+{
+	return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+char ReferenceUpper(char c)
+{
+	return c >= 'a' && c <= 'z' ? static_cast<char>(c - ('a' - 'A')) : c;
+}
+
+std::string ReferenceToLower(const std::string& s)
+{
+	std::ostringstream ss;
+	for (char c: s)
+	{
+		ss << ReferenceLower(c);
+	}
+	return ss.str();
+}
+
+std::string ReferenceToUpper(const std::string& s)
+{
+	std::ostringstream ss;
+	for (char c: s)
+	{
+		ss << ReferenceUpper(c);
+	}
+	return ss.str();
+}
+
+std::string ReferenceCapitalize(const std::string& s, bool cap)
+{
+	std::ostringstream ss;
+	for (char h: s)
+	{
+		auto c = ReferenceLower(h);
+		if (cap && ReferenceUpper(c) != c)
+		{
+			c = ReferenceUpper(c);
+			cap = false;
+		}
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\n') cap = true;
+		ss << c;
+	}
+	return ss.str();
+}
+
+std::string RandomText(std::mt19937* rng, std::size_t size)
+{
+	// the letters, the characters next to them, spaces and characters above 127
+	constexpr std::string_view alphabet
+		= "aZ \t\n\r.,@[`{\x80\xff"
+		  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+	std::uniform_int_distribution<std::size_t> pick{0, alphabet.size() - 1};
+	std::string text;
+	for (std::size_t i = 0; i < size; i += 1)
+	{
+		text += alphabet[pick(*rng)];
+	}
+	return text;
+}
+}  //  namespace
+
+TEST_CASE("case conversion")
+{
+	std::mt19937 rng{42};
+	for (std::size_t size = 0; size < 100; size += 1)
+	{
+		for (int round = 0; round < 20; round += 1)
+		{
+			const auto text = RandomText(&rng, size);
+			REQUIRE(forma::strings::ToLower(text) == ReferenceToLower(text));
+			REQUIRE(forma::strings::ToUpper(text) == ReferenceToUpper(text));
+			REQUIRE(forma::strings::Capitalize(text, true) == ReferenceCapitalize(text, true));
+			REQUIRE(forma::strings::Capitalize(text, false) == ReferenceCapitalize(text, false));
+		}
+	}
+
+	SECTION("capitalize without simd")
+	{
+		using forma::strings::CapitalizeAscii;
+		using forma::strings::CapitalizeAsciiScalar;
+		for (const std::size_t size: {31, 32, 33, 100, 1500})
+		{
+			const auto text = RandomText(&rng, size);
+			std::string output(text.size(), '\0');
+			const auto cap = CapitalizeAsciiScalar(text.data(), output.data(), size, true);
+			CHECK(output == ReferenceCapitalize(text, true));
+			CHECK(cap == CapitalizeAscii(text.data(), output.data(), size, true));
+		}
+	}
+
+	SECTION("capitalize over chunks")
+	{
+		const auto text = RandomText(&rng, 5000);
+		std::string output;
+		forma::StringSink sink{&output};
+		forma::strings::WriteCapitalized(text, true, sink);
+		CHECK(output == ReferenceCapitalize(text, true));
+	}
+}
+
+TEST_CASE("case conversion benchmark", "[.][benchmark]")
+{
+	std::mt19937 rng{42};
+	const auto text = RandomText(&rng, 64 * 1024);
+
+	BENCHMARK("lower, reference")
+	{
+		return ReferenceToLower(text);
+	};
+	BENCHMARK("lower")
+	{
+		return forma::strings::ToLower(text);
+	};
+	BENCHMARK("upper, reference")
+	{
+		return ReferenceToUpper(text);
+	};
+	BENCHMARK("upper")
+	{
+		return forma::strings::ToUpper(text);
+	};
+	BENCHMARK("capitalize, reference")
+	{
+		return ReferenceCapitalize(text, true);
+	};
+	BENCHMARK("capitalize")
+	{
+		return forma::strings::Capitalize(text, true);
+	};
+}
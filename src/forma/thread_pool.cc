@@ -0,0 +1,188 @@
+#include "forma/thread_pool.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <optional>
+
+namespace forma
+{
+// a single ForEach call
+struct ThreadPool::Job
+{
+	// the indices not yet claimed by a thread, the owner takes from the front, thieves from the back
+	struct Range
+	{
+		std::mutex mutex;
+		std::size_t begin = 0;
+		std::size_t end = 0;
+	};
+
+	const std::function<void(std::size_t, std::size_t)>* task;
+	std::size_t slots;
+	std::unique_ptr<Range[]> ranges;
+
+	std::atomic<std::size_t> left;  // indices not yet done
+	std::mutex mutex;
+	std::condition_variable done;
+	std::exception_ptr error;
+
+	Job(std::size_t count, std::size_t s, const std::function<void(std::size_t, std::size_t)>* t)
+		: task(t)
+		, slots(s)
+		, ranges(std::make_unique<Range[]>(s))
+		, left(count)
+	{
+		for (std::size_t slot = 0; slot < slots; slot += 1)
+		{
+			ranges[slot].begin = count * slot / slots;
+			ranges[slot].end = count * (slot + 1) / slots;
+		}
+	}
+
+	std::optional<std::size_t> Take(std::size_t home)
+	{
+		{
+			auto& own = ranges[home];
+			std::scoped_lock lock{own.mutex};
+			if (own.begin < own.end)
+			{
+				own.begin += 1;
+				return own.begin - 1;
+			}
+		}
+
+		for (std::size_t offset = 1; offset < slots; offset += 1)
+		{
+			auto& victim = ranges[(home + offset) % slots];
+			std::size_t begin = 0;
+			std::size_t end = 0;
+			{
+				std::scoped_lock lock{victim.mutex};
+				const auto available = victim.end - victim.begin;
+				if (available == 0) continue;
+				end = victim.end;
+				begin = end - (available + 1) / 2;
+				victim.end = begin;
+			}
+
+			// only the owner refills its own range, so it is still empty
+			auto& own = ranges[home];
+			std::scoped_lock lock{own.mutex};
+			own.begin = begin + 1;
+			own.end = end;
+			return begin;
+		}
+
+		return std::nullopt;
+	}
+
+	// run tasks until there is nothing left to claim
+	void Work(std::size_t home)
+	{
+		while (const auto index = Take(home))
+		{
+			try
+			{
+				(*task)(*index, home);
+			}
+			catch (...)
+			{
+				std::scoped_lock lock{mutex};
+				if (error == nullptr)
+				{
+					error = std::current_exception();
+				}
+			}
+
+			if (left.fetch_sub(1) == 1)
+			{
+				std::scoped_lock lock{mutex};
+				done.notify_all();
+			}
+		}
+	}
+};
+
+ThreadPool::ThreadPool(std::size_t count)
+{
+	threads.reserve(count);
+	for (std::size_t worker = 0; worker < count; worker += 1)
+	{
+		threads.emplace_back([this, worker] { WorkerLoop(worker); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::scoped_lock lock{mutex};
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& thread: threads)
+	{
+		thread.join();
+	}
+}
+
+std::size_t ThreadPool::Slots() const
+{
+	return threads.size() + 1;
+}
+
+void ThreadPool::ForEach(
+	std::size_t count, const std::function<void(std::size_t, std::size_t)>& task
+)
+{
+	if (count == 0) return;
+
+	auto job = std::make_shared<Job>(count, Slots(), &task);
+	if (threads.empty() == false)
+	{
+		{
+			std::scoped_lock lock{mutex};
+			jobs.emplace_back(job);
+		}
+		wake.notify_all();
+	}
+
+	// the caller always uses the first slot
+	job->Work(0);
+
+	{
+		std::unique_lock lock{job->mutex};
+		job->done.wait(lock, [&job] { return job->left == 0; });
+	}
+
+	{
+		std::scoped_lock lock{mutex};
+		std::erase(jobs, job);
+	}
+
+	if (job->error != nullptr)
+	{
+		std::rethrow_exception(job->error);
+	}
+}
+
+void ThreadPool::WorkerLoop(std::size_t worker)
+{
+	while (true)
+	{
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock lock{mutex};
+			wake.wait(lock, [this] { return stopping || jobs.empty() == false; });
+			if (stopping) return;
+			job = jobs.back();
+		}
+
+		job->Work(worker + 1);
+
+		// everything is claimed, stop offering it to the other workers
+		std::scoped_lock lock{mutex};
+		std::erase(jobs, job);
+	}
+}
+}  //  namespace forma
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace forma
+{
+// A fixed set of worker threads that run indexed loops.
+// Each participating thread starts with a slice of the indices and steals half of the
+// remaining indices of another thread once it runs out.
+class ThreadPool
+{
+   public:
+
+	explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// the number of threads that can run a loop: the workers and the calling thread
+	std::size_t Slots() const;
+
+	// Calls task(index, slot) for every index in [0, count) and returns when all are done.
+	// The calling thread helps out, so it's fine to call this from a task.
+	// Slot is in [0, Slots()) and unique for each thread working on this loop, use it to
+	// index per thread buffers.
+	// If any task throws, the first exception is rethrown once all tasks are done.
+	void ForEach(std::size_t count, const std::function<void(std::size_t, std::size_t)>& task);
+
+	struct Job;
+
+   private:
+
+	void WorkerLoop(std::size_t worker);
+
+	std::vector<std::thread> threads;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::vector<std::shared_ptr<Job>> jobs;  // loops with indices left to claim
+	bool stopping = false;
+};
+}  //  namespace forma